@@ -1,148 +1,677 @@
 /**
  * This program performs some timing experiments on some of the commonly
- * used Linux system calls. It executes the system calls with the specified 
- * arguments and reports the execution time in microseconds.
+ * used Linux system calls. Each system call is executed many times after a
+ * warm up, every execution is timed on its own and the minimum, median, 99th
+ * percentile and mean execution times are reported in nanoseconds, after
+ * subtracting the overhead of reading the timer. The process is pinned to a
+ * CPU so that the measurements are not disturbed by migrations.
+ * With -s the program instead sweeps read and write sizes from 512 bytes up to
+ * the given size in powers of two, comparing buffered, pread/pwrite, O_DIRECT
+ * and mmap accesses, the cost of fsync and fdatasync, and reads with the page
+ * cache warm and cold (dropped with posix_fadvise before each read).
+ * With -u reads, writes and opens are submitted to io_uring in batches of 1
+ * to 256 operations and their amortized cost is compared with the same
+ * operations made as blocking system calls, one at a time but timed in
+ * batches of 256 (the batch column, queue_depth is 1).
+ * Usage: ./cost [-n iterations] [-c cpu (-1 to not pin)] [-r (use rdtsc)] [-s max bytes] [-u]
  * @author Efe Acer
  * @version 1.0
  */
- 
+
+#define _GNU_SOURCE
+
 // Necessary imports to be able to run the system calls
-#include <sys/time.h> 
-#include <sys/types.h> 
-#include <unistd.h> 
-#include <fcntl.h> 
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h> // io_uring is used through raw system calls, without liburing
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // for __rdtsc()
+#endif
+
+// Definitions
+#define FILE_NAME "read.txt"
+#define DIRECTORY_NAME "costDirectory"
+#define MAX_SIZE 100000
+#define MIN_SWEEP_SIZE 512
+#define MAX_SWEEP_SIZE (1 << 30)
+#define SWEEP_BYTES (256 << 20) // bytes moved per sweep point, at least 3 iterations
+#define ALIGNMENT 4096 // of the buffer, the largest O_DIRECT block size that is probed
+#define URING_SIZE 4096 // bytes of each read and write in the io_uring mode
+#define URING_MAX_DEPTH 256 // largest batch (queue depth) submitted to io_uring
+
+// A system call to be measured, before and after are not timed
+typedef struct {
+    const char* name;
+    int size; // bytes read or written, 0 for other calls
+    void (*before)(int size);
+    void (*call)(int size);
+    void (*after)(int size);
+} Operation;
+
+// The rings of an io_uring instance, shared with the kernel
+typedef struct {
+    int fd;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+} Uring;
 
 // Function decleration(s)
+void pinToCpu(int cpu);
+void calibrateTsc();
 unsigned long getCurrentTime();
+int compareLongs(const void* a, const void* b);
+void measure(const char* name, int size, int count, void (*before)(int), void (*call)(int), void (*after)(int));
+void runSweep(int maxSize);
+int probeDirectSize();
+int setupUring();
+void submitBatch(int opcode, int depth);
+void callBatch(int opcode, int depth);
+void measureBatches(const char* name, int opcode, int depth, int useUring);
+void runUring();
+void callNothing(int size);
+void callGetpid(int size);
+void callOpen(int size);
+void callClose(int size);
+void callRead(int size);
+void callWrite(int size);
+void callStat(int size);
+void callMkdir(int size);
+void callRmdir(int size);
+void rewindFile(int size);
+void callPread(int size);
+void callPwrite(int size);
+void callPwriteFsync(int size);
+void callPwriteFdatasync(int size);
+void callDirectRead(int size);
+void callDirectWrite(int size);
+void callMmapRead(int size);
+void dropCache(int size);
+void dropCacheAndRewind(int size);
 
-int main() {
-    printf("\nTime measurements for different system calls in microseconds follows:\n");
-    
-    // Preparation for getpid() measurements
-    unsigned long getpidStart;
-    unsigned long getpidEnd;
-    int processID;
-
-    // Get process ID
-    getpidStart = getCurrentTime();
-    processID = getpid();
-    getpidEnd = getCurrentTime();
-    printf("\nTime to execute getpid(): %ld\n", getpidEnd - getpidStart);
-    printf("Process ID is: %d\n", processID);
-
-    // Preparation for open() measurements
-    int fileDescriptor;
-    unsigned long openStart;
-    unsigned long openEnd;
-
-    // Create a .txt file that will be used to read bytes from
-    openStart = getCurrentTime();
-    fileDescriptor = open("read.txt", O_CREAT | O_RDWR | O_APPEND,  00700); // 00700 is for file owner permissions
-    openEnd = getCurrentTime();
-    printf("\nTime to execute open() to create a new .txt file is: %ld\n", openEnd - openStart);
-    printf("The value of fileDescriptor is %d:\n", fileDescriptor); 
-    
-    // Preparation for write() measurements
-    unsigned char bytes[100000];
-    for (int i = 0; i < 100000; i++) {
-        bytes[i] = '.';	
-    }
-    unsigned long writeStart;
-    unsigned long writeEnd;
-    int numWritten;
-
-    // Write 100 bytes to read.txt
-    writeStart = getCurrentTime();
-    numWritten = write(fileDescriptor, &bytes, 100);
-    writeEnd = getCurrentTime();
-    printf("\nTime to execute write() for %d bytes: %ld\n", numWritten, (writeEnd - writeStart));
-
-    // Write 1000 bytes to read.txt
-    writeStart = getCurrentTime();
-    numWritten = write(fileDescriptor, &bytes, 1000);
-    writeEnd = getCurrentTime();
-    printf("Time to execute write() for %d bytes: %ld\n", numWritten, (writeEnd - writeStart));
-
-    // Write 10000 bytes to read.txt
-    writeStart = getCurrentTime();
-    numWritten = write(fileDescriptor, &bytes, 10000);
-    writeEnd = getCurrentTime();
-    printf("Time to execute write() for %d bytes: %ld\n", numWritten, (writeEnd - writeStart));
-
-    // Write 100000 bytes to read.txt
-    writeStart= getCurrentTime();
-    numWritten = write(fileDescriptor, &bytes, 100000);
-    writeEnd = getCurrentTime();
-    printf("Time to execute write() for %d bytes: %ld\n", numWritten, (writeEnd - writeStart));
-    
-    // Restore the pointer that is used to read and write to the file
-    close(fileDescriptor);
-    fileDescriptor = open("read.txt", O_RDWR, 00700); // 00700 is for file owner permissions
-
-    // Preparation for read() measurements
-    unsigned char buffer[111100];
-    unsigned long readStart;
-    unsigned long readEnd;
-    int numRead;	
-	
-    // Read 100 bytes from read.txt
-    readStart = getCurrentTime();
-    numRead = read(fileDescriptor, &buffer, 100);
-    readEnd = getCurrentTime();
-    printf("\nTime to execute read() for %d bytes: %ld\n", numRead, (readEnd - readStart));
-
-    // Read 1000 bytes from read.txt
-    readStart = getCurrentTime();
-    numRead = read(fileDescriptor, &buffer, 1000);
-    readEnd = getCurrentTime();
-    printf("Time to execute read() for %d bytes: %ld\n", numRead, (readEnd - readStart));
-
-    // Read 10000 bytes from read.txt
-    readStart = getCurrentTime();
-    numRead = read(fileDescriptor, &buffer, 10000);
-    readEnd = getCurrentTime();
-    printf("Time to execute read() for %d bytes: %ld\n", numRead, (readEnd - readStart));
-
-    // Read 100000 bytes from read.txt
-    readStart = getCurrentTime();
-    numRead = read(fileDescriptor, &buffer, 100000);
-    readEnd = getCurrentTime();
-    printf("Time to execute read() for %d bytes: %ld\n", numRead, (readEnd - readStart));
-
-    // Preparation for mkdir() measurements
-    unsigned long mkdirStart;
-    unsigned long mkdirEnd;
-    int success;
-
-    // Make a directory with all access permissions given
-    mkdirStart = getCurrentTime();
-    success = mkdir("allAccessPermissionsGiven", ACCESSPERMS);
-    mkdirEnd = getCurrentTime();
-    printf("\nTime to execute mkdir() giving all access permissions: %ld\n", mkdirEnd - mkdirStart);
-    printf("Successful creation (0 is OK if -1 the directory probably exists): %d\n", success);
-    
-    // Make a directory with only read permissions given
-    mkdirStart = getCurrentTime();
-    success = mkdir("onlyReadPermissionsGiven", S_IRUSR | S_IRGRP | S_IROTH);
-    mkdirEnd = getCurrentTime();
-    printf("Time to execute mkdir() giving only read permissions: %ld\n", mkdirEnd - mkdirStart);
-    printf("Successful creation (0 is OK if -1 the directory probably exists): %d\n", success);    
+// Global Variables
+int iterations = 10000; // timed executions of each system call
+int useTsc = 0; // read the time stamp counter instead of clock_gettime()
+double tscPerNs = 1.0; // time stamp counter ticks per nanosecond
+long overhead = 0; // median time of an empty measurement in nanoseconds
+long* samples; // execution times of the system call being measured
+int fileDescriptor = -1; // file used by read() and write()
+int openedDescriptor = -1; // file opened by open() and closed by close()
+int directDescriptor = -1; // the same file opened with O_DIRECT
+unsigned char* bytes; // data read and written, aligned for O_DIRECT
+Uring uring;
+int results[URING_MAX_DEPTH]; // result of each operation of the last batch
+
+// The system calls, with the sizes of the original experiments for read() and write()
+const Operation OPERATIONS[] = {
+    {"getpid", 0, NULL, callGetpid, NULL},
+    {"open", 0, NULL, callOpen, callClose},
+    {"close", 0, callOpen, callClose, NULL},
+    {"stat", 0, NULL, callStat, NULL},
+    {"write", 100, rewindFile, callWrite, NULL},
+    {"write", 1000, rewindFile, callWrite, NULL},
+    {"write", 10000, rewindFile, callWrite, NULL},
+    {"write", 100000, rewindFile, callWrite, NULL},
+    {"read", 100, rewindFile, callRead, NULL},
+    {"read", 1000, rewindFile, callRead, NULL},
+    {"read", 10000, rewindFile, callRead, NULL},
+    {"read", 100000, rewindFile, callRead, NULL},
+    {"mkdir", 0, NULL, callMkdir, callRmdir},
+    {"rmdir", 0, callMkdir, callRmdir, NULL},
+};
+
+// The accesses compared at every size of the sweep
+const Operation SWEEP_OPERATIONS[] = {
+    {"write", 0, rewindFile, callWrite, NULL},
+    {"pwrite", 0, NULL, callPwrite, NULL},
+    {"pwrite+fsync", 0, NULL, callPwriteFsync, NULL},
+    {"pwrite+fdatasync", 0, NULL, callPwriteFdatasync, NULL},
+    {"direct-pwrite", 0, NULL, callDirectWrite, NULL},
+    {"read-warm", 0, rewindFile, callRead, NULL},
+    {"read-cold", 0, dropCacheAndRewind, callRead, NULL},
+    {"pread-warm", 0, NULL, callPread, NULL},
+    {"pread-cold", 0, dropCache, callPread, NULL},
+    {"direct-pread", 0, NULL, callDirectRead, NULL},
+    {"mmap-read-warm", 0, NULL, callMmapRead, NULL},
+    {"mmap-read-cold", 0, dropCache, callMmapRead, NULL},
+};
+
+int main(int argc, char* argv[]) {
+    int cpu = 0;
+    int sweepSize = 0; // largest size of the sweep, 0 measures the system calls
+    int uringMode = 0; // compare io_uring batches with blocking system calls
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:rs:u")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'c': cpu = atoi(optarg); break;
+            case 'r': useTsc = 1; break;
+            case 's': sweepSize = atoi(optarg); break;
+            case 'u': uringMode = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-c cpu (-1 to not pin)] [-r (use rdtsc)] "
+                        "[-s max bytes] [-u]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (iterations < 1) {
+        fprintf(stderr, "The number of iterations must be positive.\n");
+        return 1;
+    }
+    if (sweepSize != 0 && (sweepSize < MIN_SWEEP_SIZE || sweepSize > MAX_SWEEP_SIZE)) {
+        fprintf(stderr, "The sweep size must be between %d and %d bytes.\n", MIN_SWEEP_SIZE, MAX_SWEEP_SIZE);
+        return 1;
+    }
+    samples = malloc(iterations * sizeof(long));
+    if (samples == NULL) {
+        fprintf(stderr, "Cannot allocate space for the samples.\n");
+        return 1;
+    }
+    if (cpu >= 0) {
+        pinToCpu(cpu);
+    }
+    if (useTsc) {
+        calibrateTsc();
+    }
+    int fileSize = (sweepSize > MAX_SIZE) ? sweepSize : MAX_SIZE;
+    if (uringMode && fileSize < URING_MAX_DEPTH * URING_SIZE) {
+        fileSize = URING_MAX_DEPTH * URING_SIZE; // every operation of a batch has its own block
+    }
+    if (posix_memalign((void**) &bytes, ALIGNMENT, fileSize) != 0) {
+        fprintf(stderr, "Cannot allocate space for the data.\n");
+        return 1;
+    }
+    memset(bytes, '.', fileSize);
+    fileDescriptor = open(FILE_NAME, O_CREAT | O_RDWR | O_TRUNC, 00700); // 00700 is for file owner permissions
+    if (fileDescriptor == -1 || write(fileDescriptor, bytes, fileSize) != fileSize) {
+        perror(FILE_NAME);
+        return 1;
+    }
+    rmdir(DIRECTORY_NAME); // left by an interrupted run
+
+    if (uringMode) {
+        runUring();
+    } else {
+        printf("call,bytes,iterations,min_ns,median_ns,p99_ns,mean_ns,median_mb_per_s\n");
+        measure("timer", 0, iterations, NULL, callNothing, NULL); // the overhead itself, not subtracted
+        overhead = samples[iterations / 2];
+        if (sweepSize > 0) {
+            runSweep(sweepSize);
+        } else {
+            for (unsigned int i = 0; i < sizeof(OPERATIONS) / sizeof(Operation); i++) {
+                const Operation* operation = &OPERATIONS[i];
+                measure(operation->name, operation->size, iterations, operation->before, operation->call,
+                        operation->after);
+            }
+        }
+    }
 
+    close(fileDescriptor);
+    unlink(FILE_NAME);
+    free(bytes);
+    free(samples);
     return 0;
 }
 
 /**
- * Returns the current time in microseconds. The current 
- * time corresponds to the time elapsed from the starting 
- * point used by the gettimeofday() function.
- * @return currentTime: The current time in microseconds
+ * Restricts the process to a single CPU. A failure (e.g. the CPU does not
+ * exist) is reported and the measurements continue unpinned.
+ * @param cpu The CPU to run on
+ */
+void pinToCpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        perror("sched_setaffinity");
+    }
+}
+
+/**
+ * Measures how many time stamp counter ticks pass in a nanosecond by comparing
+ * the counter with clock_gettime() over 100 milliseconds. Falls back to
+ * clock_gettime() if the CPU has no time stamp counter.
+ */
+void calibrateTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    useTsc = 0;
+    unsigned long start = getCurrentTime();
+    unsigned long long ticks = __rdtsc();
+    while (getCurrentTime() - start < 100000000UL);
+    tscPerNs = (double) (__rdtsc() - ticks) / (getCurrentTime() - start);
+    useTsc = 1;
+#else
+    fprintf(stderr, "rdtsc is not available, using clock_gettime().\n");
+    useTsc = 0;
+#endif
+}
+
+/**
+ * Returns the current time in nanoseconds, from the time stamp counter if
+ * useTsc is set and from the monotonic clock otherwise.
+ * @return currentTime: The current time in nanoseconds
  */
 unsigned long getCurrentTime() {
-    struct timeval timeValue;
-    gettimeofday(&timeValue, NULL);
-    unsigned long currentTime = timeValue.tv_usec; // microseconds part of the struct
-    currentTime += timeValue.tv_sec * 1e6; // add the seconds part of the struct
-    return currentTime;
+#if defined(__x86_64__) || defined(__i386__)
+    if (useTsc) {
+        return (unsigned long) (__rdtsc() / tscPerNs);
+    }
+#endif
+    struct timespec timeValue;
+    clock_gettime(CLOCK_MONOTONIC, &timeValue);
+    return timeValue.tv_sec * 1000000000UL + timeValue.tv_nsec;
+}
+
+int compareLongs(const void* a, const void* b) {
+    long x = *((const long*) a);
+    long y = *((const long*) b);
+    return (x > y) - (x < y);
+}
+
+/**
+ * Executes a system call count / 10 times (at least once) to warm up the
+ * caches, then times each of count executions and prints a CSV line of
+ * statistics, with the throughput at the median time if the call moves bytes.
+ * The samples are left sorted in samples.
+ * @param name Name of the system call
+ * @param size Bytes read or written, 0 for other calls
+ * @param count Number of timed executions, at most iterations
+ * @param before Untimed preparation of each execution, may be NULL
+ * @param call The timed system call
+ * @param after Untimed clean up of each execution, may be NULL
+ */
+void measure(const char* name, int size, int count, void (*before)(int), void (*call)(int), void (*after)(int)) {
+    int warmup = (count / 10 > 0) ? count / 10 : 1; // untimed executions
+    for (int i = -warmup; i < count; i++) {
+        if (before != NULL) {
+            before(size);
+        }
+        unsigned long start = getCurrentTime();
+        call(size);
+        unsigned long end = getCurrentTime();
+        if (after != NULL) {
+            after(size);
+        }
+        if (i >= 0) {
+            long sample = (long) (end - start) - overhead;
+            samples[i] = (sample > 0) ? sample : 0;
+        }
+    }
+    qsort(samples, count, sizeof(long), compareLongs);
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    int p99 = (int) (0.99 * count);
+    long median = samples[count / 2];
+    printf("%s,%d,%d,%ld,%ld,%ld,%.1f,%.1f\n", name, size, count, samples[0], median,
+           samples[(p99 < count) ? p99 : count - 1], sum / count,
+           (size > 0 && median > 0) ? size * 1e3 / median : 0.0);
+}
+
+/**
+ * Measures every access of SWEEP_OPERATIONS at the sizes from MIN_SWEEP_SIZE
+ * to maxSize in powers of two, always at the beginning of the file. Each size
+ * is executed SWEEP_BYTES / size times (at least 3, at most iterations). The
+ * file is synced before the reads, since posix_fadvise only drops clean pages.
+ * The direct accesses are skipped (and reported) at the sizes below the block
+ * size of the device, which O_DIRECT rejects.
+ * @param maxSize The largest size
+ */
+void runSweep(int maxSize) {
+    int directSize = MAX_SWEEP_SIZE; // smallest size accepted with O_DIRECT
+    directDescriptor = open(FILE_NAME, O_RDWR | O_DIRECT);
+    if (directDescriptor == -1) {
+        perror("O_DIRECT is not supported, skipping the direct accesses");
+    } else if ((directSize = probeDirectSize()) == -1) {
+        fprintf(stderr, "O_DIRECT accesses of up to %d bytes fail, skipping the direct accesses.\n", ALIGNMENT);
+        close(directDescriptor);
+        directDescriptor = -1;
+    }
+    for (long size = MIN_SWEEP_SIZE; size <= maxSize; size *= 2) {
+        int count = SWEEP_BYTES / size;
+        count = (count < 3) ? 3 : (count > iterations) ? iterations : count;
+        fsync(fileDescriptor);
+        for (unsigned int i = 0; i < sizeof(SWEEP_OPERATIONS) / sizeof(Operation); i++) {
+            const Operation* operation = &SWEEP_OPERATIONS[i];
+            if (strncmp(operation->name, "direct", 6) == 0 && (directDescriptor == -1 || size < directSize)) {
+                if (directDescriptor != -1) {
+                    fprintf(stderr, "%s,%ld: skipped, below the O_DIRECT block size of %d bytes.\n",
+                            operation->name, size, directSize);
+                }
+                continue;
+            }
+            if (operation->before == dropCache || operation->before == dropCacheAndRewind) {
+                fdatasync(fileDescriptor); // written pages are dirty and would stay cached
+            }
+            measure(operation->name, size, count, operation->before, operation->call, operation->after);
+        }
+    }
+    if (directDescriptor != -1) {
+        close(directDescriptor);
+    }
+}
+
+/**
+ * Finds the block size of the device under the file by reading its beginning
+ * with O_DIRECT at the sweep sizes up to ALIGNMENT, which fail with EINVAL
+ * below the logical block size.
+ * @return The smallest size that can be read, -1 if none of them can
+ */
+int probeDirectSize() {
+    for (int size = MIN_SWEEP_SIZE; size <= ALIGNMENT; size *= 2) {
+        if (pread(directDescriptor, bytes, size, 0) == size) {
+            return size;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Creates an io_uring instance with URING_MAX_DEPTH entries and maps its
+ * submission queue, completion queue and submission queue entries.
+ * @return 0 on success, -1 if io_uring is not available
+ */
+int setupUring() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring.fd = syscall(__NR_io_uring_setup, URING_MAX_DEPTH, &params);
+    if (uring.fd == -1) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) { // both queues in one mapping
+        sqSize = cqSize = (sqSize > cqSize) ? sqSize : cqSize;
+    }
+    char* sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd,
+                    IORING_OFF_SQ_RING);
+    char* cq = sq;
+    if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd,
+                  IORING_OFF_CQ_RING);
+    }
+    uring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || uring.sqes == MAP_FAILED) {
+        perror("mmap (io_uring)");
+        close(uring.fd);
+        return -1;
+    }
+    uring.sqHead = (unsigned*) (sq + params.sq_off.head);
+    uring.sqTail = (unsigned*) (sq + params.sq_off.tail);
+    uring.sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+    uring.sqArray = (unsigned*) (sq + params.sq_off.array);
+    uring.cqHead = (unsigned*) (cq + params.cq_off.head);
+    uring.cqTail = (unsigned*) (cq + params.cq_off.tail);
+    uring.cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * Submits depth operations to io_uring with a single io_uring_enter() and
+ * waits for all of them to complete. Operation i reads or writes the i-th
+ * block of URING_SIZE bytes, or opens the file; its result is put in results.
+ * @param opcode IORING_OP_READ, IORING_OP_WRITE or IORING_OP_OPENAT
+ * @param depth Number of operations, at most URING_MAX_DEPTH
+ */
+void submitBatch(int opcode, int depth) {
+    unsigned tail = *uring.sqTail;
+    for (int i = 0; i < depth; i++) {
+        unsigned index = tail & *uring.sqMask;
+        struct io_uring_sqe* sqe = &uring.sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        if (opcode == IORING_OP_OPENAT) {
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long) FILE_NAME;
+            sqe->open_flags = O_RDONLY;
+        } else {
+            sqe->fd = fileDescriptor;
+            sqe->addr = (unsigned long) (bytes + i * URING_SIZE);
+            sqe->len = URING_SIZE;
+            sqe->off = i * URING_SIZE;
+        }
+        sqe->user_data = i;
+        uring.sqArray[index] = index;
+        tail++;
+    }
+    __atomic_store_n(uring.sqTail, tail, __ATOMIC_RELEASE); // publish the entries
+    int toSubmit = depth;
+    int completed = 0;
+    while (completed < depth) {
+        int submitted = syscall(__NR_io_uring_enter, uring.fd, toSubmit, depth - completed,
+                                IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted > 0) {
+            toSubmit -= submitted;
+        } else if (submitted == -1 && errno != EINTR) { // retried if a signal interrupted the wait
+            perror("io_uring_enter");
+            exit(1);
+        }
+        unsigned head = *uring.cqHead;
+        unsigned cqTail = __atomic_load_n(uring.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != cqTail; head++) {
+            struct io_uring_cqe* cqe = &uring.cqes[head & *uring.cqMask];
+            results[cqe->user_data] = cqe->res;
+            completed++;
+        }
+        __atomic_store_n(uring.cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Makes the operations of submitBatch one after another as blocking system
+ * calls.
+ * @param opcode IORING_OP_READ, IORING_OP_WRITE or IORING_OP_OPENAT
+ * @param depth Number of operations, at most URING_MAX_DEPTH
+ */
+void callBatch(int opcode, int depth) {
+    for (int i = 0; i < depth; i++) {
+        if (opcode == IORING_OP_OPENAT) {
+            results[i] = open(FILE_NAME, O_RDONLY);
+        } else if (opcode == IORING_OP_READ) {
+            results[i] = pread(fileDescriptor, bytes + i * URING_SIZE, URING_SIZE, i * URING_SIZE);
+        } else {
+            results[i] = pwrite(fileDescriptor, bytes + i * URING_SIZE, URING_SIZE, i * URING_SIZE);
+        }
+    }
+}
+
+/**
+ * Times about iterations operations made in batches of depth operations,
+ * after a tenth as many untimed ones, and prints a CSV line with the amortized
+ * cost of an operation. The line gives the batch size and the queue depth, the
+ * number of operations in flight at once: depth for io_uring, 1 for blocking
+ * calls. The files opened by a batch are closed untimed.
+ * @param name Name of the operation
+ * @param opcode IORING_OP_READ, IORING_OP_WRITE or IORING_OP_OPENAT
+ * @param depth Number of operations in a batch
+ * @param useUring 1 to submit the batches to io_uring, 0 for blocking calls
+ */
+void measureBatches(const char* name, int opcode, int depth, int useUring) {
+    int batches = (iterations + depth - 1) / depth;
+    unsigned long total = 0;
+    int failures = 0;
+    for (int b = -batches / 10 - 1; b < batches; b++) {
+        unsigned long start = getCurrentTime();
+        if (useUring) {
+            submitBatch(opcode, depth);
+        } else {
+            callBatch(opcode, depth);
+        }
+        unsigned long end = getCurrentTime();
+        if (b >= 0) {
+            total += end - start;
+        }
+        for (int i = 0; i < depth; i++) {
+            if (results[i] < 0) {
+                failures++;
+            } else if (opcode == IORING_OP_OPENAT) {
+                close(results[i]);
+            }
+        }
+    }
+    if (failures > 0) {
+        fprintf(stderr, "%s (%s, depth %d): %d operations failed.\n", name,
+                useUring ? "io_uring" : "sync", depth, failures);
+    }
+    long operations = (long) batches * depth;
+    double nsPerOperation = (double) total / operations;
+    printf("%s,%s,%d,%d,%d,%ld,%.1f,%.0f,%.1f\n", name, useUring ? "io_uring" : "sync",
+           (opcode == IORING_OP_OPENAT) ? 0 : URING_SIZE, depth, useUring ? depth : 1, operations,
+           nsPerOperation, 1e9 / nsPerOperation,
+           (opcode == IORING_OP_OPENAT) ? 0.0 : URING_SIZE * 1e3 / nsPerOperation);
+}
+
+/**
+ * Measures reads, writes and opens as blocking system calls and submitted to
+ * io_uring at queue depths 1, 2, 4, ..., URING_MAX_DEPTH. The reads and
+ * writes hit the page cache, so the numbers show the cost of the system call
+ * path rather than of the disk.
+ */
+void runUring() {
+    const char* names[] = {"read", "write", "open"};
+    const int opcodes[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_OPENAT};
+    int available = (setupUring() == 0);
+    printf("call,mode,bytes,batch,queue_depth,operations,ns_per_op,ops_per_s,mb_per_s\n");
+    for (int i = 0; i < 3; i++) {
+        measureBatches(names[i], opcodes[i], URING_MAX_DEPTH, 0);
+        for (int depth = 1; available && depth <= URING_MAX_DEPTH; depth *= 2) {
+            measureBatches(names[i], opcodes[i], depth, 1);
+        }
+    }
+    if (available) {
+        close(uring.fd);
+    }
+}
+
+void callNothing(int size) {
+}
+
+void callGetpid(int size) {
+    syscall(SYS_getpid); // getpid() may be answered without a system call
+}
+
+void callOpen(int size) {
+    openedDescriptor = open(FILE_NAME, O_RDONLY);
+}
+
+void callClose(int size) {
+    close(openedDescriptor);
+}
+
+void callRead(int size) {
+    if (read(fileDescriptor, bytes, size) != size) {
+        perror("read");
+    }
+}
+
+void callWrite(int size) {
+    if (write(fileDescriptor, bytes, size) != size) {
+        perror("write");
+    }
+}
+
+void callStat(int size) {
+    struct stat status;
+    stat(FILE_NAME, &status);
+}
+
+void callMkdir(int size) {
+    mkdir(DIRECTORY_NAME, ACCESSPERMS);
+}
+
+void callRmdir(int size) {
+    rmdir(DIRECTORY_NAME);
+}
+
+/**
+ * Moves the file offset back to the beginning so that every read() and
+ * write() accesses the same bytes of the file.
+ * @param size Unused
+ */
+void rewindFile(int size) {
+    lseek(fileDescriptor, 0, SEEK_SET);
+}
+
+void callPread(int size) {
+    if (pread(fileDescriptor, bytes, size, 0) != size) {
+        perror("pread");
+    }
+}
+
+void callPwrite(int size) {
+    if (pwrite(fileDescriptor, bytes, size, 0) != size) {
+        perror("pwrite");
+    }
+}
+
+void callPwriteFsync(int size) {
+    callPwrite(size);
+    fsync(fileDescriptor);
+}
+
+void callPwriteFdatasync(int size) {
+    callPwrite(size);
+    fdatasync(fileDescriptor);
+}
+
+void callDirectRead(int size) {
+    if (pread(directDescriptor, bytes, size, 0) != size) {
+        perror("pread (O_DIRECT)");
+    }
+}
+
+void callDirectWrite(int size) {
+    if (pwrite(directDescriptor, bytes, size, 0) != size) {
+        perror("pwrite (O_DIRECT)");
+    }
+}
+
+/**
+ * Maps the first size bytes of the file, copies them to bytes (the same work
+ * as a read()) and unmaps them.
+ * @param size Bytes to read
+ */
+void callMmapRead(int size) {
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    memcpy(bytes, map, size);
+    munmap(map, size);
+}
+
+/**
+ * Drops the pages holding the first size bytes of the file from the page
+ * cache, so that the next read comes from the disk. The range is rounded up to
+ * whole pages since posix_fadvise ignores partial pages.
+ * @param size Bytes to drop
+ */
+void dropCache(int size) {
+    posix_fadvise(fileDescriptor, 0, (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT, POSIX_FADV_DONTNEED);
+}
+
+void dropCacheAndRewind(int size) {
+    dropCache(size);
+    rewindFile(size);
 }
@@ -2,30 +2,95 @@
  * A simple command line interpreter called "bilshell". It has a batch mode, in which
  * it can execute commands inside an input file in order. It also has an interactive
  * mode, in which the user specifies the command to execute. "bilshell" also supports
- * composed command execution upto two commands. The code below makes use of various
- * system calls and pipes as an Inter Process Communication (IPC) mechanism.
+ * composed commands (pipelines) of any number of stages and background jobs, and the
+ * batch mode can run the lines of its file concurrently. The code below makes use of
+ * various system calls and pipes as an Inter Process Communication (IPC) mechanism.
  * @author Efe Acer
  * @version 1.0
  */
 
 // Necessary imports
+#define _GNU_SOURCE // for splice
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
 
 // Definitions
 #define clearTerminal() printf("\033[H\033[J")
-#define MAX_LETTERS 1000 // maximum number of letters allowed in a command
-#define MAX_ARGS 10 // maximum number of arguments allowed in a command
+#define MAX_JOBS 64 // maximum number of background jobs running at the same time
+#define HASH_SIZE 64 // number of buckets in the table of command paths
 #define READ_END 0
 #define WRITE_END 1
 #define STDIN_FD 0
 #define STDOUT_FD 1
+#define RELAY_COPY 0 // read() into a buffer and write() it
+#define RELAY_SPLICE 1 // splice() from pipe to pipe, the bytes stay in the kernel
+#define AUTO_MIN_SIZE 4096 // initial relay buffer size if N is "auto"
+#define AUTO_MAX_SIZE (1 << 20) // largest relay buffer and pipe size if N is "auto"
+
+// Files replacing the standard input and output of a command
+typedef struct {
+    char* input; // "< file", NULL if there is none
+    char* output; // "> file" or ">> file", NULL if there is none
+    int append; // the output was given with ">>"
+} Redirection;
+
+// A line split into the words of its commands, see parseLine
+typedef struct {
+    char** words; // words of the line, the argument vector of each command ends with NULL
+    int numWords;
+    int wordCapacity;
+    int* starts; // index of the first word of each command
+    Redirection* redirections; // redirections of each command
+    int numCommands;
+    int commandCapacity;
+    int background; // the line ends with "&"
+} ParsedLine;
+
+// A command running in the background
+typedef struct {
+    pid_t* pids; // process of each command of the line, -1 once it is collected
+    char** names; // name of each command for the timing mode, NULL for a relaying shell
+    int numPids;
+    int numRunning; // processes not collected yet, the job is done at 0
+    int id;
+    char* command; // printed when the job is done, NULL if it was not started with "&"
+    struct timespec start; // the time the job was started
+} Job;
+
+// A command whose path was found in PATH
+typedef struct HashEntry {
+    char* name;
+    char* path;
+    int hits; // number of times the command was started
+    struct HashEntry* next; // next entry in the same bucket
+} HashEntry;
 
 // Global Variable(s)
-unsigned int N = 10000;
+unsigned int N = 0; // size of the relay buffer, 0 connects the stages directly
+int relayMode = RELAY_COPY;
+int autoSize = 0; // adapt the relay buffer and pipe sizes to the pipeline
+int timingMode = 0; // print the resource usage of every command
+extern char** environ;
+HashEntry* commandTable[HASH_SIZE]; // paths of the commands found in PATH
+char* hashedPath = NULL; // value of PATH when commandTable was filled, NULL if PATH was unset
+int isHashed = 0; // commandTable holds commands found with hashedPath
+char* uncachedPath = NULL; // last path that resolveCommand could not store in commandTable
+Job jobs[MAX_JOBS]; // running background jobs
+int numJobs = 0;
+int nextJobId = 1;
+int jobLimit = 1; // lines of the batch file that may run at the same time
 
 // Funtion declerations
 void initInteractiveMode();
@@ -33,21 +98,55 @@ void initBatchMode();
 void printCurrDir();
 void runBatchMode(char fileName[]);
 void runInteractiveMode();
-void readInput(char command[]);
-void parseCommand(char command[], char* argv1[]);
-int parseComposedCommand(char command[], char* commands[]);
-int parseUnknownCommand(char command[], char* argv1[], char* argv2[]);
+int readInput(char** command, size_t* capacity);
+int parseLine(char command[], ParsedLine* line);
+int addWord(ParsedLine* line, char* word);
+int addCommand(ParsedLine* line);
+void freeParsedLine(ParsedLine* line);
 int handleBuiltInCommands(char* argv1[]);
-void executeCommand(char* argv1[]);
-void executeComposedCommand(char* argv1[], char* argv2[]);
-void handleCommand(char command[]);
+void setRelayMode(char* mode);
+void setTimingMode(char* mode);
+unsigned int hashName(char name[]);
+char* searchPath(char name[]);
+char* resolveCommand(char name[]);
+void forgetCommand(char name[]);
+void clearCommandTable();
+void hashCommand(char* option);
+pid_t spawnCommand(char* argv1[], Redirection* redirection, int inFd, int outFd,
+                   int pipes[][2], int numPipes);
+char* failedRedirection(Redirection* redirection);
+void waitCommands(pid_t pids[], char* names[], int numCommands, struct timespec* start);
+void printUsage(char* name, struct timespec* start, struct rusage* usage);
+void executeCommand(char* argv1[], Redirection* redirection);
+void executeComposedCommand(char** argvs[], Redirection redirections[], int numCommands);
+void spawnPipeline(char** argvs[], Redirection redirections[], int numCommands,
+                   int upstream[][2], int downstream[][2], pid_t pids[]);
+void relayPipes(int upstream[][2], int downstream[][2], int numLinks);
+void growLink(int upstream[], int downstream[], unsigned int* size, char** buffer);
+void closePipes(int pipes[][2], int numPipes);
+int isBuiltInName(char name[]);
+char* lineText(ParsedLine* line);
+void startJob(ParsedLine* line, int announce);
+void freeJob(Job* job);
+int reapJobs(int block);
+void waitJobs();
+void handleCommand(ParsedLine* line);
+void executeUnknownCommand(ParsedLine* line);
 
 // Main function
 int main(int argc, char* argv[]) {
-    if (argc > 1) {
+    if (argc > 1 && strcmp(argv[1], "auto") == 0) {
+        autoSize = 1;
+        N = AUTO_MIN_SIZE;
+    } else if (argc > 1) {
         N = atoi(argv[1]); // get the value of N (will be used in experiments)
     }
-    int isBatchMode = (argc == 3);
+    signal(SIGPIPE, SIG_IGN); // a stage that exits early must not kill the relay
+    int isBatchMode = (argc >= 3);
+    if (argc > 3) {
+        jobLimit = atoi(argv[3]); // run up to jobLimit lines of the file concurrently
+        jobLimit = (jobLimit < 1) ? 1 : (jobLimit > MAX_JOBS) ? MAX_JOBS : jobLimit;
+    }
     if (isBatchMode) {
         initBatchMode();
         runBatchMode(argv[2]);
@@ -93,119 +192,267 @@ void printCurrDir() {
 /**
  * Runs the program in the batch mode, in which commands inside a file are
  * consecutively executed. Each command corresponds to a line in the file.
+ * If jobLimit is larger than 1, up to jobLimit lines run at the same time as
+ * background jobs. A built in command waits for the running lines first, so
+ * that e.g. cd applies to the lines after it. Returns when every line is done.
  * @param fileName The strinf for the name of the file containing the commands
  */
 void runBatchMode(char fileName[]) {
     FILE* fp = fopen(fileName, "r");
-    char buffer[MAX_LETTERS];
+    if (fp == NULL) {
+        fprintf(stderr, "\nCannot open the file %s.\n", fileName);
+        exit(1);
+    }
+    char* command = NULL; // grows to the longest line
+    size_t capacity = 0;
+    ParsedLine line = {0}; // reused for every line
     printf("\nStarting execution of the commands in the file.\n");
-    while (fgets(buffer, MAX_LETTERS, fp)) {
-        buffer[strcspn(buffer, "\n\r")] = '\0'; // remove the newline at the end
-        char command[strlen(buffer)];
-        strcpy(command, buffer);
-        handleCommand(command);
+    while (getline(&command, &capacity, fp) != -1) {
+        command[strcspn(command, "\n\r")] = '\0'; // remove the newline at the end
+        reapJobs(0);
+        if (parseLine(command, &line) <= 0) {
+            continue;
+        }
+        if (jobLimit == 1 || line.background) {
+            handleCommand(&line);
+        } else if (isBuiltInName(line.words[0])) {
+            waitJobs();
+            handleCommand(&line);
+        } else {
+            while (numJobs >= jobLimit) {
+                reapJobs(1);
+            }
+            startJob(&line, 0);
+        }
     }
+    free(command);
+    freeParsedLine(&line);
     fclose(fp);
+    waitJobs();
 }
 
 /**
  * Runs the program in the interactive mode, where the user enters the commands.
  */
 void runInteractiveMode() {
-    char command[MAX_LETTERS];
+    char* command = NULL; // grows to the longest line
+    size_t capacity = 0;
+    ParsedLine line = {0}; // reused for every line
     while (1) {
-        readInput(command);
-        handleCommand(command);
+        reapJobs(0);
+        if (readInput(&command, &capacity) == -1) { // end of input, same as exit
+            printf("\nThank you for using Bilshell :)\n");
+            exit(0);
+        }
+        if (parseLine(command, &line) > 0) {
+            handleCommand(&line);
+        }
     }
 }
 
 /**
- * Reads a line from stdin and saves it into the command string.
+ * Reads a line from stdin and saves it into the command string, which is
+ * reallocated if the line does not fit.
  * @param command The string into which the entered line is saved.
+ * @param capacity The size of the string
+ * @return The length of the line, -1 at the end of the input
  */
-void readInput(char command[]) {
-    char buffer[MAX_LETTERS];
+int readInput(char** command, size_t* capacity) {
     printCurrDir();
     printf("\nbilshell-$: ");
-    fgets(buffer, MAX_LETTERS, stdin);
-    buffer[strcspn(buffer, "\n\r")] = '\0'; // remove the newline at the end
-    strcpy(command, buffer);
+    fflush(stdout);
+    if (getline(command, capacity, stdin) == -1) {
+        return -1;
+    }
+    (*command)[strcspn(*command, "\n\r")] = '\0'; // remove the newline at the end
+    return strlen(*command);
 }
 
 /**
- * Given a command, parses it and constructs its argument vector.
- * @param command The command as a string
- * @param argv1 The argument vector corresponding to the command
+ * Splits a line into the argument vectors of its commands in a single pass. The
+ * words are separated by blanks and the commands by "|"; a "&" at the end of the
+ * line makes it a background command. "< file", "> file" and ">> file" redirect
+ * the standard input and output of a command. Inside single quotes every character is
+ * taken as it is, inside double quotes a backslash escapes a double quote or a
+ * backslash and outside quotes a backslash escapes any character. The line is
+ * modified in place (quotes are removed and the words are terminated), the words
+ * of line point into it.
+ * @param command The line, modified
+ * @param line The parsed line, its arrays grow as needed
+ * @return The number of commands, 0 if the line is empty and -1 on a syntax error
  */
-void parseCommand(char command[], char* argv1[]) {
-    for (int i = 0; i < MAX_ARGS + 1; i++) {
-        argv1[i] = strsep(&command, " ");
-        if (argv1[i] == NULL) {
-            break;
+int parseLine(char command[], ParsedLine* line) {
+    line->numWords = 0;
+    line->numCommands = 0;
+    line->background = 0;
+    if (addCommand(line) == -1) {
+        return -1;
+    }
+    int wordsInCommand = 0;
+    char redirect = 0; // '<', '>' or 'a' (">>") if the next word is a file name
+    char* read = command;
+    while (1) {
+        read += strspn(read, " \t");
+        char delimiter;
+        if (*read != '\0' && strchr("|&<>", *read) == NULL) { // a word
+            char* word = read;
+            char* write = read; // behind read once a quote or backslash is removed
+            while (*read != '\0' && strchr(" \t|&<>", *read) == NULL) {
+                if (*read == '\'' || *read == '"') {
+                    char quote = *read++;
+                    while (*read != '\0' && *read != quote) {
+                        if (quote == '"' && *read == '\\' && (read[1] == '"' || read[1] == '\\')) {
+                            read++;
+                        }
+                        *write++ = *read++;
+                    }
+                    if (*read == '\0') {
+                        fprintf(stderr, "\nUnmatched quote.");
+                        return -1;
+                    }
+                    read++;
+                } else {
+                    if (*read == '\\' && read[1] != '\0') {
+                        read++;
+                    }
+                    *write++ = *read++;
+                }
+            }
+            delimiter = *read; // terminating the word may overwrite it
+            read += (delimiter != '\0');
+            *write = '\0';
+            Redirection* redirection = &line->redirections[line->numCommands - 1];
+            if (redirect == '<') {
+                redirection->input = word;
+            } else if (redirect != 0) {
+                redirection->output = word;
+                redirection->append = (redirect == 'a');
+            } else if (addWord(line, word) == -1) {
+                return -1;
+            } else {
+                wordsInCommand++;
+            }
+            redirect = 0;
+        } else {
+            delimiter = *read;
+            read += (delimiter != '\0');
+        }
+        if (delimiter == ' ' || delimiter == '\t') {
+            continue;
+        }
+        if (redirect != 0) {
+            fprintf(stderr, "\nMissing file name after a redirection.");
+            return -1;
+        }
+        if (delimiter == '<' || delimiter == '>') {
+            redirect = delimiter;
+            if (delimiter == '>' && *read == '>') {
+                redirect = 'a';
+                read++;
+            }
+            continue;
+        }
+        // end of a command
+        Redirection* redirection = &line->redirections[line->numCommands - 1];
+        if (wordsInCommand == 0 && (redirection->input != NULL || redirection->output != NULL)) {
+            fprintf(stderr, "\nMissing command for a redirection.");
+            return -1;
+        }
+        if (wordsInCommand == 0 && (delimiter == '|' || line->numCommands > 1)) {
+            fprintf(stderr, "\nEmpty command in the composed command.");
+            return -1;
         }
-        i -= (strlen(argv1[i]) == 0);
+        if (wordsInCommand == 0) { // an empty line
+            return 0;
+        }
+        if (addWord(line, NULL) == -1) {
+            return -1;
+        }
+        if (delimiter == '&') {
+            read += strspn(read, " \t");
+            if (*read != '\0') {
+                fprintf(stderr, "\n\"&\" can only end a command.");
+                return -1;
+            }
+            line->background = 1;
+        }
+        if (delimiter != '|') {
+            return line->numCommands;
+        }
+        if (addCommand(line) == -1) {
+            return -1;
+        }
+        wordsInCommand = 0;
     }
 }
 
 /**
- * Tries to parse a given command into two separate commands. If the
- * command cannot be parsed in such a way, returns 0 (false), otherwise
- * returns 1 (true).
- * @param command The command as a string
- * @param commands The two separate commands that composes the first one,
- *                 if the command can be composed
- * @return 0 (false) if the command cannot be composed into two  separate
- *         commands, 1 (true) if it can be composed
+ * Appends a word to a parsed line, doubling its array of words when it is full.
+ * @param line The parsed line
+ * @param word The word, NULL to end the argument vector of a command
+ * @return 0 on success, -1 if memory cannot be allocated
  */
-int parseComposedCommand(char command[], char* commands[]) {
-    for (int i = 0; i < 2; i++) {
-        commands[i] = strsep(&command, "|");
-        if (commands[i] == NULL) {
-            break;
+int addWord(ParsedLine* line, char* word) {
+    if (line->numWords == line->wordCapacity) {
+        int capacity = (line->wordCapacity == 0) ? 16 : 2 * line->wordCapacity;
+        char** words = realloc(line->words, capacity * sizeof(char*));
+        if (words == NULL) {
+            fprintf(stderr, "\nCannot allocate space for the command.");
+            return -1;
         }
+        line->words = words;
+        line->wordCapacity = capacity;
     }
-    // return 1 (true) if the command is a composed one, 0 (false) otherwise
-    return (commands[1] != NULL);
-}
-
-/**
- * Given an unknown command, meaning that we do not know whether it is
- * a composed command of two parts or a simple command, parses the command
- * and constructs argument vector(s). A single argument vector is formed
- * (argv1) if the command is a simple command, two argument vectors (argv1
- * and argv2) are formed if the command is a composed command. If the command
- * is "exit", quits the program. Returns a flag "isComposedCommand" that is
- * 0 (false) if the command is a simple one and 1 (true) otherwise. The value
- * of the flag, however, is -1 if the command is a built in command.
- * @param command The unknown command as a string
- * @param argv1 The argument vector for the first part of the composed command
- *              or for the simple command, depending on the particular case
- * @param argv2 The argument vector for the second part of the composed command,
- *              if, of course, the command is a composed one
- * @return isComposedCommand a flag that is 0 (false) if the command is
- *                           a simple one and 1 (true) otherwise, an exception
- *                           is that the flag is -1 if the command is a built in one
- */
-int parseUnknownCommand(char command[], char* argv1[], char* argv2[]) {
-    char* commands[2];
-    int isComposedCommand = parseComposedCommand(command, commands);
-    if (isComposedCommand) {
-        parseCommand(commands[0], argv1);
-        parseCommand(commands[1], argv2);
-    } else {
-        parseCommand(command, argv1);
-    }
-    int isBuiltInCommand = handleBuiltInCommands(argv1);
-    if (isBuiltInCommand) {
-        return -1;
+    line->words[line->numWords++] = word;
+    return 0;
+}
+
+/**
+ * Starts a new command without redirections in a parsed line at its next word,
+ * doubling its arrays of commands when they are full.
+ * @param line The parsed line
+ * @return 0 on success, -1 if memory cannot be allocated
+ */
+int addCommand(ParsedLine* line) {
+    if (line->numCommands == line->commandCapacity) {
+        int capacity = (line->commandCapacity == 0) ? 4 : 2 * line->commandCapacity;
+        int* starts = realloc(line->starts, capacity * sizeof(int));
+        if (starts != NULL) {
+            line->starts = starts;
+        }
+        Redirection* redirections = realloc(line->redirections, capacity * sizeof(Redirection));
+        if (redirections != NULL) {
+            line->redirections = redirections;
+        }
+        if (starts == NULL || redirections == NULL) {
+            fprintf(stderr, "\nCannot allocate space for the command.");
+            return -1;
+        }
+        line->commandCapacity = capacity;
     }
-    return isComposedCommand;
+    Redirection none = {NULL, NULL, 0};
+    line->redirections[line->numCommands] = none;
+    line->starts[line->numCommands++] = line->numWords;
+    return 0;
+}
+
+/**
+ * Frees the arrays of a parsed line (not the words, they belong to the line).
+ * @param line The parsed line
+ */
+void freeParsedLine(ParsedLine* line) {
+    free(line->words);
+    free(line->starts);
+    free(line->redirections);
 }
 
 /**
  * Handles the execution of the built in commands (additional ones) such as
- * exit (used to quit bilshell), cd (used to change the directory) and help
- * (used to print a manual of bilshell). Returns 0 (false) if the command
+ * exit (used to quit bilshell), cd (used to change the directory), help
+ * (used to print a manual of bilshell), relay (used to select how composed
+ * commands are relayed), wait (used to wait for the background jobs) and timing
+ * (used to report the resource usage of the commands) and hash (used to list or
+ * clear the paths of the commands found in PATH). Returns 0 (false) if the command
  * is not a built in command, 1 (true) otherwise.
  * @param argv1 The argument vector of the built in command
  * @return 0 (false) if the command is not a built in command, 1 (true) otherwise
@@ -217,120 +464,872 @@ int handleBuiltInCommands(char* argv1[]) {
     } else if (strcmp(argv1[0], "cd") == 0) {
         chdir(argv1[1]); // change directory
         return 1;
+    } else if (strcmp(argv1[0], "relay") == 0) {
+        setRelayMode(argv1[1]);
+        return 1;
+    } else if (strcmp(argv1[0], "timing") == 0) {
+        setTimingMode(argv1[1]);
+        return 1;
+    } else if (strcmp(argv1[0], "hash") == 0) {
+        hashCommand(argv1[1]);
+        return 1;
+    } else if (strcmp(argv1[0], "wait") == 0) {
+        waitJobs(); // wait for the background jobs
+        return 1;
     } else if (strcmp(argv1[0], "help") == 0) {
         printf("\nBILSHELL:\nA simple command line interpreter that supports "
-               "the following commands:\n> exit\n> cd\n> help\n> many UNIX commands"
-               "\n> composed commands of two\n");
+               "the following commands:\n> exit\n> cd\n> help\n> relay [copy|splice]\n> wait\n> timing [on|off]\n> hash [-r]"
+               "\n> many UNIX commands\n> composed commands of any length (a | b | c ...)"
+               "\n> background jobs (command &)\n");
         return 1;
     }
     return 0;
 }
 
+/**
+ * Selects how the parent relays the bytes of composed commands when N is positive,
+ * either by copying them through a buffer (copy) or by moving them between the pipes
+ * with splice() (splice). Prints the current mode if no mode is given.
+ * @param mode The name of the mode, may be NULL
+ */
+void setRelayMode(char* mode) {
+    if (mode == NULL) {
+        printf("\nrelay: %s%s\n", (relayMode == RELAY_SPLICE) ? "splice" : "copy",
+               (N == 0) ? " (unused, N is 0)" : "");
+    } else if (strcmp(mode, "copy") == 0) {
+        relayMode = RELAY_COPY;
+    } else if (strcmp(mode, "splice") == 0) {
+        relayMode = RELAY_SPLICE;
+    } else {
+        fprintf(stderr, "\nUnknown relay mode %s, use copy or splice.", mode);
+    }
+}
+
+/**
+ * Turns the resource usage report of the commands on or off. Prints the current
+ * mode if no mode is given.
+ * @param mode "on" or "off", may be NULL
+ */
+void setTimingMode(char* mode) {
+    if (mode == NULL) {
+        printf("\ntiming: %s\n", timingMode ? "on" : "off");
+    } else if (strcmp(mode, "on") == 0 || strcmp(mode, "off") == 0) {
+        timingMode = (strcmp(mode, "on") == 0);
+    } else {
+        fprintf(stderr, "\nUnknown timing mode %s, use on or off.", mode);
+    }
+}
+
+/**
+ * Computes the bucket of a command name in commandTable (djb2 hash).
+ * @param name The name of the command
+ * @return The index of the bucket
+ */
+unsigned int hashName(char name[]) {
+    unsigned int hash = 5381;
+    for (int i = 0; name[i] != '\0'; i++) {
+        hash = hash * 33 + (unsigned char) name[i];
+    }
+    return hash % HASH_SIZE;
+}
+
+/**
+ * Searches the directories in PATH for an executable file with the given name.
+ * An empty directory in PATH stands for the current directory.
+ * @param name The name of the command
+ * @return The path of the command (to be freed), NULL if it is not found
+ */
+char* searchPath(char name[]) {
+    char* path = getenv("PATH");
+    if (path == NULL) {
+        path = "/usr/local/bin:/usr/bin:/bin";
+    }
+    char candidate[strlen(path) + strlen(name) + 3];
+    while (path != NULL) {
+        int length = strcspn(path, ":");
+        if (length == 0) {
+            sprintf(candidate, "./%s", name);
+        } else {
+            sprintf(candidate, "%.*s/%s", length, path, name);
+        }
+        struct stat info;
+        if (stat(candidate, &info) == 0 && S_ISREG(info.st_mode) && access(candidate, X_OK) == 0) {
+            return strdup(candidate);
+        }
+        path = (path[length] == ':') ? path + length + 1 : NULL;
+    }
+    return NULL;
+}
+
+/**
+ * Finds the path of a command, from commandTable if it was found before and by
+ * searching PATH otherwise. The table is cleared if PATH has changed since it was
+ * filled, including being set or unset. A name containing "/" is a path already
+ * and is not stored. If memory for the table cannot be allocated the command is
+ * still found, but it is searched again the next time.
+ * @param name The name of the command
+ * @return The path of the command, NULL if it is not found
+ */
+char* resolveCommand(char name[]) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    char* path = getenv("PATH");
+    int changed = (path == NULL || hashedPath == NULL) ? (path != hashedPath)
+                                                      : (strcmp(path, hashedPath) != 0);
+    if (isHashed && changed) {
+        clearCommandTable(); // PATH has changed
+    }
+    unsigned int bucket = hashName(name);
+    for (HashEntry* entry = commandTable[bucket]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            entry->hits++;
+            return entry->path;
+        }
+    }
+    char* found = searchPath(name);
+    if (found == NULL) {
+        return NULL; // a missing command is not stored
+    }
+    HashEntry* entry = malloc(sizeof(HashEntry));
+    char* entryName = strdup(name);
+    if (!isHashed && path != NULL) {
+        hashedPath = strdup(path);
+    }
+    if (entry == NULL || entryName == NULL || (path != NULL && hashedPath == NULL)) {
+        fprintf(stderr, "\nCannot allocate space for the command table, %s is not remembered.", name);
+        free(entry);
+        free(entryName);
+        if (!isHashed) {
+            free(hashedPath);
+            hashedPath = NULL;
+        }
+        free(uncachedPath); // no longer used by the caller
+        uncachedPath = found;
+        return found;
+    }
+    isHashed = 1;
+    entry->name = entryName;
+    entry->path = found;
+    entry->hits = 1;
+    entry->next = commandTable[bucket];
+    commandTable[bucket] = entry;
+    return found;
+}
+
+/**
+ * Removes a command from commandTable, e.g. after its file has been removed.
+ * @param name The name of the command
+ */
+void forgetCommand(char name[]) {
+    HashEntry** link = &commandTable[hashName(name)];
+    while (*link != NULL) {
+        HashEntry* entry = *link;
+        if (strcmp(entry->name, name) == 0) {
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+        link = &entry->next;
+    }
+}
+
+/**
+ * Removes every command from commandTable.
+ */
+void clearCommandTable() {
+    for (int i = 0; i < HASH_SIZE; i++) {
+        while (commandTable[i] != NULL) {
+            forgetCommand(commandTable[i]->name);
+        }
+    }
+    free(hashedPath);
+    hashedPath = NULL;
+    isHashed = 0;
+}
+
+/**
+ * Handles the hash built in command, which prints commandTable (number of times
+ * each command was started and its path) or clears it if the option is "-r".
+ * @param option The option of the command, may be NULL
+ */
+void hashCommand(char* option) {
+    if (option != NULL && strcmp(option, "-r") == 0) {
+        clearCommandTable();
+        return;
+    } else if (option != NULL) {
+        fprintf(stderr, "\nUnknown option %s, use hash [-r].", option);
+        return;
+    }
+    printf("\nhits\tcommand\n");
+    for (int i = 0; i < HASH_SIZE; i++) {
+        for (HashEntry* entry = commandTable[i]; entry != NULL; entry = entry->next) {
+            printf("%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+}
+
+/**
+ * Starts a command as a separate process with posix_spawn, which does not copy
+ * the address space of the shell as fork() does. The path of the command is taken
+ * from resolveCommand; if the file is gone the command is searched in PATH again.
+ * The standard input and output of the child are redirected first, to the given
+ * descriptors and then to the files of the redirection (opened by the child
+ * itself), then the given pipes are closed in the child and SIGPIPE is restored
+ * to its default action. If the command cannot be started because a file of the
+ * redirection cannot be opened, that file is reported here.
+ * @param argv1 Argument vector of the command
+ * @param redirection Files to use as the standard input and output, may be NULL
+ * @param inFd Descriptor to use as the standard input, -1 to keep it
+ * @param outFd Descriptor to use as the standard output, -1 to keep it
+ * @param pipes Pipes to close in the child, may be NULL
+ * @param numPipes Number of pipes
+ * @return The process id of the child, -1 (errno is set) if it cannot be started
+ *         and -2 if a file of the redirection cannot be opened (already reported)
+ */
+pid_t spawnCommand(char* argv1[], Redirection* redirection, int inFd, int outFd,
+                   int pipes[][2], int numPipes) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attributes;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attributes);
+    if (inFd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, inFd, STDIN_FD);
+    }
+    if (outFd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, outFd, STDOUT_FD);
+    }
+    if (redirection != NULL && redirection->input != NULL) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FD, redirection->input, O_RDONLY, 0);
+    }
+    if (redirection != NULL && redirection->output != NULL) {
+        int flags = O_WRONLY | O_CREAT | (redirection->append ? O_APPEND : O_TRUNC);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FD, redirection->output, flags, 0666);
+    }
+    for (int i = 0; i < numPipes; i++) { // close unused ends
+        posix_spawn_file_actions_addclose(&actions, pipes[i][READ_END]);
+        if (pipes[i][WRITE_END] != pipes[i][READ_END]) {
+            posix_spawn_file_actions_addclose(&actions, pipes[i][WRITE_END]);
+        }
+    }
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+    pid_t pid;
+    int error = ENOENT;
+    char* path = resolveCommand(argv1[0]);
+    if (path != NULL) {
+        error = posix_spawn(&pid, path, &actions, &attributes, argv1, environ);
+    }
+    if (path != NULL && error == ENOENT && path != argv1[0] && access(path, X_OK) != 0) { // stale
+        forgetCommand(argv1[0]);
+        path = resolveCommand(argv1[0]);
+        error = (path != NULL) ? posix_spawn(&pid, path, &actions, &attributes, argv1, environ) : ENOENT;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    char* file = (error != 0 && path != NULL) ? failedRedirection(redirection) : NULL;
+    if (file != NULL) { // the command exists, its redirection failed in the child
+        fprintf(stderr, "\nCannot open %s: %s.", file, strerror(errno));
+        return -2;
+    }
+    errno = error;
+    return (error == 0) ? pid : -1;
+}
+
+/**
+ * Finds the file of a redirection that cannot be opened, checked with access()
+ * so that nothing is created or truncated: the input must be readable, and the
+ * output writable or creatable in its directory.
+ * @param redirection The redirection, may be NULL
+ * @return The name of the file (errno is set), NULL if both files can be opened
+ */
+char* failedRedirection(Redirection* redirection) {
+    if (redirection == NULL) {
+        return NULL;
+    }
+    if (redirection->input != NULL && access(redirection->input, R_OK) != 0) {
+        return redirection->input;
+    }
+    char* output = redirection->output;
+    if (output == NULL || access(output, W_OK) == 0) {
+        return NULL;
+    }
+    if (errno != ENOENT) { // exists but cannot be written
+        return output;
+    }
+    char directory[strlen(output) + 2];
+    strcpy(directory, output);
+    char* slash = strrchr(directory, '/');
+    if (slash == NULL) {
+        strcpy(directory, ".");
+    } else {
+        slash[slash == directory] = '\0'; // keep "/" for a file in the root
+    }
+    return (access(directory, W_OK | X_OK) != 0) ? output : NULL;
+}
+
 /**
  * Given the argument vector of a command, executes it as a separate process.
  * @param argv1 Argument vector of the command
  */
-void executeCommand(char* argv1[]) {
-    pid_t pid = fork(); // fork a child
-    if (pid < 0) { // error case
-        fprintf(stderr, "\nFork failed.");
-        exit(1);
-    } else if (pid == 0) { // child process
-        if (execvp(argv1[0], argv1) < 0) {
-            fprintf(stderr, "\nCommand execution failed.");
+void executeCommand(char* argv1[], Redirection* redirection) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = spawnCommand(argv1, redirection, -1, -1, NULL, 0);
+    if (pid < 0) {
+        if (pid == -1) {
+            fprintf(stderr, "\nCommand execution failed: %s.", strerror(errno));
+        }
+        return;
+    }
+    waitCommands(&pid, argv1, 1, &start); // wait for the child to complete
+}
+
+/**
+ * Waits for the given commands to complete. In the timing mode the resource usage
+ * of each command is collected with wait4() and printed as soon as the command
+ * exits: every command has a pidfd, so that the commands are collected in the
+ * order they exit and not in the order of the pipeline.
+ * @param pids Process ids of the commands, the ones below 0 are skipped
+ * @param names Names of the commands
+ * @param numCommands Number of commands
+ * @param start The time the commands were started
+ */
+void waitCommands(pid_t pids[], char* names[], int numCommands, struct timespec* start) {
+    struct rusage usage;
+    struct pollfd fds[numCommands];
+    int numOpen = 0;
+    for (int i = 0; i < numCommands; i++) {
+        fds[i].fd = (timingMode && pids[i] > 0) ? syscall(SYS_pidfd_open, pids[i], 0) : -1;
+        fds[i].events = POLLIN; // the process has exited
+        numOpen += (fds[i].fd >= 0);
+    }
+    while (numOpen > 0) {
+        if (poll(fds, numCommands, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        for (int i = 0; i < numCommands; i++) {
+            if (fds[i].fd >= 0 && fds[i].revents != 0) {
+                wait4(pids[i], NULL, 0, &usage);
+                printUsage(names[i], start, &usage);
+                close(fds[i].fd);
+                fds[i].fd = -1; // ignored by poll
+                pids[i] = -1;
+                numOpen--;
+            }
+        }
+    }
+    for (int i = 0; i < numCommands; i++) { // no pidfd (timing off or not supported)
+        if (pids[i] > 0) {
+            wait4(pids[i], NULL, 0, &usage);
+            if (timingMode) {
+                printUsage(names[i], start, &usage);
+            }
+        }
+    }
+}
+
+/**
+ * Prints the resource usage of a command that has just been collected.
+ * @param name Name of the command
+ * @param start The time the command was started
+ * @param usage The resource usage of the command returned by wait4()
+ */
+void printUsage(char* name, struct timespec* start, struct rusage* usage) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("\n%s: wall-time: %.3f s, user-time: %.3f s, sys-time: %.3f s, max-rss: %ld KB, "
+           "context-switches: %ld voluntary %ld involuntary, page-faults: %ld minor %ld major\n",
+           name, (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9,
+           usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+           usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6, usage->ru_maxrss,
+           usage->ru_nvcsw, usage->ru_nivcsw, usage->ru_minflt, usage->ru_majflt);
+}
+
+/**
+ * Given the argument vectors of the commands of a composed command, executes them
+ * as a pipeline such that the output of each command is fed as input to the next one.
+ * If N is 0 consecutive commands share a pipe. Otherwise, the parent relays the bytes
+ * between two pipes per link using a buffer of N bytes and prints some statistics
+ * about number of bytes transferred between the pipes, number of calls to read and
+ * number of calls to write.
+ * @param argvs Argument vectors of the commands, in the order of the pipeline
+ * @param numCommands Number of commands in the pipeline
+ */
+void executeComposedCommand(char** argvs[], Redirection redirections[], int numCommands) {
+    int numLinks = numCommands - 1;
+    int upstream[numLinks][2]; // pipe i is written by command i
+    int downstream[numLinks][2]; // pipe i is read by command i + 1
+    pid_t pids[numCommands];
+    char* names[numCommands];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    spawnPipeline(argvs, redirections, numCommands, upstream, downstream, pids);
+    if (N > 0) {
+        relayPipes(upstream, downstream, numLinks);
+    }
+    for (int i = 0; i < numCommands; i++) {
+        names[i] = argvs[i][0];
+    }
+    waitCommands(pids, names, numCommands, &start);
+}
+
+/**
+ * Creates the pipes of a composed command and starts its commands. The parent
+ * keeps only the ends it relays (if N is larger than 0), every other end is closed.
+ * @param argvs Argument vectors of the commands, in the order of the pipeline
+ * @param redirections Redirections of the commands
+ * @param numCommands Number of commands in the pipeline
+ * @param upstream Filled with the pipes written by the commands (numCommands - 1)
+ * @param downstream Filled with the pipes read by the commands, the same as upstream if N is 0
+ * @param pids Filled with the process ids of the commands, -1 for the ones that failed
+ */
+void spawnPipeline(char** argvs[], Redirection redirections[], int numCommands,
+                   int upstream[][2], int downstream[][2], pid_t pids[]) {
+    int numLinks = numCommands - 1;
+    for (int i = 0; i < numLinks; i++) {
+        if (pipe(upstream[i]) < 0 || (N > 0 && pipe(downstream[i]) < 0)) {
+            fprintf(stderr, "\nPipe %d failed.", i + 1);
             exit(1);
         }
-        exit(0); // successfully exit
-    } else { // parent process
-        wait(NULL); // wait for the child to complete
+        if (N == 0) { // connect the commands directly
+            downstream[i][READ_END] = upstream[i][READ_END];
+            downstream[i][WRITE_END] = upstream[i][WRITE_END];
+        }
+    }
+    int pipes[2 * numLinks][2]; // every pipe, closed in the children
+    int numPipes = 0;
+    for (int i = 0; i < numLinks; i++) {
+        pipes[numPipes][READ_END] = upstream[i][READ_END];
+        pipes[numPipes++][WRITE_END] = upstream[i][WRITE_END];
+        if (N > 0) {
+            pipes[numPipes][READ_END] = downstream[i][READ_END];
+            pipes[numPipes++][WRITE_END] = downstream[i][WRITE_END];
+        }
+    }
+    for (int i = 0; i < numCommands; i++) {
+        pids[i] = spawnCommand(argvs[i], &redirections[i], (i > 0) ? downstream[i - 1][READ_END] : -1,
+                               (i < numLinks) ? upstream[i][WRITE_END] : -1, pipes, numPipes);
+        if (pids[i] == -1) {
+            fprintf(stderr, "\nExecution of command %d failed: %s.", i + 1, strerror(errno));
+        }
+    }
+    // parent
+    if (N > 0) {
+        for (int i = 0; i < numLinks; i++) { // close unused ends
+            close(upstream[i][WRITE_END]);
+            close(downstream[i][READ_END]);
+        }
+    } else {
+        closePipes(upstream, numLinks);
     }
 }
 
 /**
- * Given the argument vectors for the two parts of a composed commands, executes the
- * parts in order such that the output of the first part is fed as input to the second
- * part via a pipe. Additionaly, prints some statistics about number of bytes transferred
- * between the pipes, number of calls to read and number of calls to write.
- * @param argv1 Argument vector of the first part of the composed command
- * @param argv2 Argument vector of the second part of the composed command
+ * Transfers the bytes written to each upstream pipe to the corresponding downstream
+ * pipe until every upstream pipe reaches end of file, then prints the statistics.
+ * The links are served with poll() and non-blocking writes, so that a command
+ * blocked on its output cannot stall the relay of the other links. In the splice
+ * mode each call moves up to N bytes between the pipes without copying them to user
+ * space, it is counted as one read and one write of those bytes. If N is "auto" the
+ * buffer of a link starts with AUTO_MIN_SIZE bytes and grows with growLink.
+ * @param upstream Pipes whose read ends are relayed
+ * @param downstream Pipes whose write ends receive the bytes
+ * @param numLinks Number of pipe pairs
  */
-void executeComposedCommand(char* argv1[], char* argv2[]) {
+void relayPipes(int upstream[][2], int downstream[][2], int numLinks) {
     // some statistics
-    int bytesTransferred = 0;
+    long bytesTransferred = 0;
     int readCount = 0;
     int writeCount = 0;
-    int fd1[2]; // pipe 1
-    if (pipe(fd1) < 0) {
-        fprintf(stderr, "\nPipe 1 failed.");
-        exit(1);
-    }
-    int fd2[2]; // pipe 2
-    if (pipe(fd2) < 0) {
-        fprintf(stderr, "\nPipe 2 failed.");
-        exit(1);
-    }
-    pid_t pid1 = fork(); // fork child 1
-    if (pid1 < 0) {
-        fprintf(stderr, "\nFork failed for child 1.");
-        exit(1);
-    } else if (pid1 == 0) { // child 1
-        close(fd2[READ_END]); // close unused ends
-        close(fd2[WRITE_END]);
-        close(fd1[READ_END]);
-        dup2(fd1[WRITE_END], STDOUT_FD);
-        if (execvp(argv1[0], argv1) < 0) {
-            fprintf(stderr, "\nExecution of the first command failed.");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long bytesRelayed = 0; // each byte once, for the throughput
+    unsigned int sizes[numLinks]; // relay buffer size of each link
+    char* buffers[numLinks];
+    int pending[numLinks]; // bytes read but not written yet (1 if a splice has to wait for
+                           // the downstream pipe), -1 if the link is closed
+    int offsets[numLinks];
+    int numOpen = numLinks;
+    for (int i = 0; i < numLinks; i++) {
+        sizes[i] = N;
+        buffers[i] = (relayMode == RELAY_COPY) ? malloc(N) : NULL;
+        if (relayMode == RELAY_COPY && buffers[i] == NULL) {
+            fprintf(stderr, "\nCannot allocate the relay buffer.");
             exit(1);
         }
-    } else {
-        pid_t pid2 = fork(); // fork child 2
-        if (pid2 < 0) {
-            fprintf(stderr, "\nFork failed for child 2.");
+        pending[i] = 0;
+        offsets[i] = 0;
+        fcntl(downstream[i][WRITE_END], F_SETFL, O_NONBLOCK);
+    }
+    struct pollfd fds[numLinks];
+    int links[numLinks]; // link of each entry in fds
+    while (numOpen > 0) {
+        int numFds = 0;
+        for (int i = 0; i < numLinks; i++) {
+            if (pending[i] == 0) {
+                fds[numFds].fd = upstream[i][READ_END];
+                fds[numFds].events = POLLIN;
+            } else if (pending[i] > 0) {
+                fds[numFds].fd = downstream[i][WRITE_END];
+                fds[numFds].events = POLLOUT;
+            } else {
+                continue;
+            }
+            links[numFds++] = i;
+        }
+        if (poll(fds, numFds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "\nPoll failed.");
             exit(1);
-        } else if (pid2 == 0) { // child 2
-            close(fd1[READ_END]); // close unused ends
-            close(fd1[WRITE_END]);
-            close(fd2[WRITE_END]);
-            dup2(fd2[READ_END], STDIN_FD);
-            if (execvp(argv2[0], argv2) < 0) {
-                fprintf(stderr, "\nExecution of the second command failed.");
-                exit(1);
+        }
+        for (int f = 0; f < numFds; f++) {
+            int i = links[f];
+            if (fds[f].revents == 0) {
+                continue;
             }
-        } else { // parent
-            close(fd1[WRITE_END]); // close unused ends
-            close(fd2[READ_END]);
-            // Transfer the bytes written to pipe 1 by child 1 to pipe 2
-            int bytesRead; // statistic
-            char buffer[N];
-            while ((bytesRead = read(fd1[READ_END], buffer, N)) > 0) {
-                int bytesWritten = write(fd2[WRITE_END], buffer, bytesRead);
-                bytesTransferred += bytesRead + bytesWritten;
+            if (relayMode == RELAY_SPLICE) {
+                ssize_t bytesMoved = splice(upstream[i][READ_END], NULL, downstream[i][WRITE_END],
+                                            NULL, sizes[i], SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (bytesMoved < 0 && errno == EAGAIN) { // the downstream pipe is full
+                    pending[i] = 1;
+                } else {
+                    readCount++;
+                    writeCount++;
+                    if (bytesMoved <= 0) { // end of file or the reader has exited
+                        pending[i] = -1;
+                    } else {
+                        bytesTransferred += 2 * bytesMoved;
+                        bytesRelayed += bytesMoved;
+                        pending[i] = 0;
+                        if (autoSize && (unsigned int) bytesMoved == sizes[i]) {
+                            growLink(upstream[i], downstream[i], &sizes[i], NULL);
+                        }
+                    }
+                }
+            } else if (pending[i] == 0) {
+                int bytesRead = read(upstream[i][READ_END], buffers[i], sizes[i]);
                 readCount++;
+                if (bytesRead <= 0) { // end of file
+                    pending[i] = -1;
+                } else {
+                    bytesTransferred += bytesRead;
+                    bytesRelayed += bytesRead;
+                    pending[i] = bytesRead;
+                    offsets[i] = 0;
+                    if (autoSize && (unsigned int) bytesRead == sizes[i]) {
+                        growLink(upstream[i], downstream[i], &sizes[i], &buffers[i]);
+                    }
+                }
+            }
+            while (relayMode == RELAY_COPY && pending[i] > 0) { // write as much as the pipe accepts
+                int bytesWritten = write(downstream[i][WRITE_END], buffers[i] + offsets[i], pending[i]);
+                if (bytesWritten < 0 && errno == EAGAIN) {
+                    break;
+                }
                 writeCount++;
+                if (bytesWritten < 0) { // the reader has exited
+                    pending[i] = -1;
+                    break;
+                }
+                bytesTransferred += bytesWritten;
+                pending[i] -= bytesWritten;
+                offsets[i] += bytesWritten;
+            }
+            if (pending[i] == -1) {
+                close(upstream[i][READ_END]); // close unused ends
+                close(downstream[i][WRITE_END]);
+                numOpen--;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    unsigned int maxSize = 0;
+    for (int i = 0; i < numLinks; i++) {
+        free(buffers[i]);
+        maxSize = (sizes[i] > maxSize) ? sizes[i] : maxSize;
+    }
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("\ncharacter-count: %ld\nread-call-count: %d\nwrite-call-count: %d\n",
+           bytesTransferred, readCount, writeCount);
+    printf("throughput: %.2f MB/s\n", (seconds > 0) ? bytesRelayed / seconds / 1e6 : 0.0);
+    if (autoSize) {
+        printf("relay-buffer-size: %u\n", maxSize);
+    }
+}
+
+/**
+ * Grows the relay buffer of a link whose last read filled the buffer, meaning that
+ * the upstream command produces faster than the link is relayed. The buffer is
+ * doubled up to AUTO_MAX_SIZE and both pipes of the link are enlarged with
+ * F_SETPIPE_SZ once the buffer is larger than them, so that a single call can move
+ * a whole buffer. A failure to enlarge the pipes (the limit of the system) is ignored.
+ * @param upstream The pipe that the link reads from
+ * @param downstream The pipe that the link writes to
+ * @param size The size of the relay buffer, updated
+ * @param buffer The relay buffer, reallocated, NULL in the splice mode
+ */
+void growLink(int upstream[], int downstream[], unsigned int* size, char** buffer) {
+    if (*size >= AUTO_MAX_SIZE) {
+        return;
+    }
+    unsigned int newSize = *size * 2;
+    if (buffer != NULL) {
+        char* grown = realloc(*buffer, newSize);
+        if (grown == NULL) {
+            return;
+        }
+        *buffer = grown;
+    }
+    *size = newSize;
+    int capacity = fcntl(upstream[READ_END], F_GETPIPE_SZ);
+    if (capacity > 0 && (unsigned int) capacity < newSize) {
+        fcntl(upstream[READ_END], F_SETPIPE_SZ, newSize);
+        fcntl(downstream[WRITE_END], F_SETPIPE_SZ, newSize);
+    }
+}
+
+/**
+ * Closes both ends of the given pipes.
+ * @param pipes The pipes to close
+ * @param numPipes Number of pipes
+ */
+void closePipes(int pipes[][2], int numPipes) {
+    for (int i = 0; i < numPipes; i++) {
+        close(pipes[i][READ_END]);
+        close(pipes[i][WRITE_END]);
+    }
+}
+
+/**
+ * Checks whether a command name is the name of a built in command.
+ * @param name The name of the command
+ * @return 1 (true) if it is the name of a built in command, 0 (false) otherwise
+ */
+int isBuiltInName(char name[]) {
+    const char* builtIns[] = {"exit", "cd", "help", "relay", "wait", "timing", "hash"};
+    for (int i = 0; i < (int) (sizeof(builtIns) / sizeof(builtIns[0])); i++) {
+        if (strcmp(name, builtIns[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Joins the words and redirections of a parsed line back into a command, to be printed.
+ * @param line The parsed line
+ * @return The command (to be freed), NULL if memory cannot be allocated
+ */
+char* lineText(ParsedLine* line) {
+    size_t length = 1;
+    for (int i = 0; i < line->numWords; i++) {
+        length += (line->words[i] != NULL) ? strlen(line->words[i]) + 1 : 2;
+    }
+    for (int c = 0; c < line->numCommands; c++) {
+        Redirection* redirection = &line->redirections[c];
+        length += (redirection->input != NULL) ? strlen(redirection->input) + 3 : 0;
+        length += (redirection->output != NULL) ? strlen(redirection->output) + 4 : 0;
+    }
+    char* text = malloc(length);
+    if (text == NULL) {
+        return NULL;
+    }
+    text[0] = '\0';
+    for (int c = 0; c < line->numCommands; c++) {
+        for (char** word = &line->words[line->starts[c]]; *word != NULL; word++) {
+            strcat(strcat(text, *word), " ");
+        }
+        Redirection* redirection = &line->redirections[c];
+        if (redirection->input != NULL) {
+            strcat(strcat(strcat(text, "< "), redirection->input), " ");
+        }
+        if (redirection->output != NULL) {
+            strcat(strcat(strcat(text, redirection->append ? ">> " : "> "), redirection->output), " ");
+        }
+        if (c < line->numCommands - 1) {
+            strcat(text, "| ");
+        }
+    }
+    text[strlen(text) - 1] = '\0'; // remove the last blank
+    return text;
+}
+
+/**
+ * Runs a parsed line (simple or composed command) without waiting for it. The
+ * commands are started by the shell itself with spawnCommand and their process
+ * ids are kept in the job, so starting a job does not copy the shell. A composed
+ * command relayed by the shell (N larger than 0) is the exception: the relay has
+ * to run while the shell reads the next line, so it runs in a fork() of the shell.
+ * If MAX_JOBS jobs are running, waits for one of them first.
+ * @param line The parsed line
+ * @param announce 1 (true) to print the job when it starts and when it is done
+ */
+void startJob(ParsedLine* line, int announce) {
+    while (numJobs == MAX_JOBS) {
+        reapJobs(1);
+    }
+    int numCommands = line->numCommands;
+    Job* job = &jobs[numJobs];
+    job->pids = malloc(numCommands * sizeof(pid_t));
+    job->names = calloc(numCommands, sizeof(char*));
+    job->numPids = 0;
+    job->command = NULL;
+    if (job->pids == NULL || job->names == NULL) {
+        fprintf(stderr, "\nCannot allocate space for the job.");
+        freeJob(job);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    if (numCommands > 1 && N > 0) {
+        fflush(stdout); // the child must not print the pending output again
+        job->pids[0] = fork();
+        job->numPids = 1;
+        if (job->pids[0] == 0) { // relaying process, it waits for the commands
+            numJobs = 0; // the jobs of the shell are not its children
+            executeUnknownCommand(line);
+            fflush(stdout);
+            _exit(0); // exit() would also reset the offset of the batch file shared with the shell
+        } else if (job->pids[0] < 0) {
+            fprintf(stderr, "\nFork failed.");
+        }
+    } else {
+        char** argvs[numCommands];
+        for (int i = 0; i < numCommands; i++) {
+            argvs[i] = &line->words[line->starts[i]];
+            job->names[i] = strdup(argvs[i][0]); // the line is reused by the caller
+        }
+        if (numCommands > 1) {
+            int upstream[numCommands - 1][2];
+            int downstream[numCommands - 1][2];
+            spawnPipeline(argvs, line->redirections, numCommands, upstream, downstream, job->pids);
+        } else {
+            job->pids[0] = spawnCommand(argvs[0], &line->redirections[0], -1, -1, NULL, 0);
+            if (job->pids[0] == -1) {
+                fprintf(stderr, "\nCommand execution failed: %s.", strerror(errno));
             }
-            readCount++;
-            close(fd1[READ_END]); // close unused ends
-            close(fd2[WRITE_END]);
-            wait(NULL);
-            wait(NULL);
-            printf("\ncharacter-count: %d\nread-call-count: %d\nwrite-call-count: %d\n",
-                   bytesTransferred, readCount, writeCount);
         }
+        job->numPids = numCommands;
+    }
+    pid_t lastPid = -1; // announced as the process id of the job
+    job->numRunning = 0;
+    for (int i = 0; i < job->numPids; i++) {
+        if (job->pids[i] > 0) {
+            lastPid = job->pids[i];
+            job->numRunning++;
+        }
+    }
+    if (job->numRunning == 0) { // nothing to wait for
+        freeJob(job);
+        return;
+    }
+    numJobs++;
+    job->id = nextJobId++;
+    job->command = announce ? lineText(line) : NULL;
+    if (announce) {
+        printf("\n[%d] %d\n", job->id, lastPid);
+    }
+}
+
+/**
+ * Frees the memory of a job, the job must not be used afterwards.
+ * @param job The job
+ */
+void freeJob(Job* job) {
+    if (job->names != NULL) {
+        for (int i = 0; i < job->numPids; i++) {
+            free(job->names[i]);
+        }
+    }
+    free(job->names);
+    free(job->pids);
+    free(job->command);
+}
+
+/**
+ * Collects the processes of the background jobs that have exited, printing their
+ * resource usage in the timing mode. A job is done when all of its processes are.
+ * @param block 1 (true) to wait until at least one job is done, 0 (false) to return at once
+ * @return The number of jobs collected
+ */
+int reapJobs(int block) {
+    int reaped = 0;
+    struct rusage usage;
+    while (numJobs > 0) {
+        pid_t pid = wait4(-1, NULL, (block && reaped == 0) ? 0 : WNOHANG, &usage);
+        if (pid <= 0) {
+            break;
+        }
+        for (int i = 0; i < numJobs; i++) {
+            int p = 0;
+            while (p < jobs[i].numPids && jobs[i].pids[p] != pid) {
+                p++;
+            }
+            if (p == jobs[i].numPids) {
+                continue;
+            }
+            if (timingMode && jobs[i].names[p] != NULL) {
+                printUsage(jobs[i].names[p], &jobs[i].start, &usage);
+            }
+            jobs[i].pids[p] = -1;
+            if (--jobs[i].numRunning == 0) {
+                if (jobs[i].command != NULL) {
+                    printf("\n[%d] Done\t%s\n", jobs[i].id, jobs[i].command);
+                }
+                freeJob(&jobs[i]);
+                jobs[i] = jobs[--numJobs];
+                reaped++;
+            }
+            break;
+        }
+    }
+    return reaped;
+}
+
+/**
+ * Waits until every background job is done.
+ */
+void waitJobs() {
+    while (numJobs > 0) {
+        reapJobs(1);
     }
 }
 
 /*
- * Given any command (simple, composed or built in), parses and executes
+ * Given any parsed command (simple, composed, built in or background), executes
  * it using the helper functions implemented above.
- * @param command The string representing the command.
- */
-void handleCommand(char command[]) {
-    char* argv1[MAX_ARGS + 1];
-    char* argv2[MAX_ARGS + 1];
-    int isComposedCommand = parseUnknownCommand(command, argv1, argv2);
-    if (isComposedCommand == 1) {
-        executeComposedCommand(argv1, argv2);
-    } else if (isComposedCommand == 0) {
-        executeCommand(argv1);
+ * @param line The parsed line
+ */
+void handleCommand(ParsedLine* line) {
+    if (handleBuiltInCommands(line->words)) {
+        return;
+    } else if (line->background) {
+        startJob(line, 1);
+    } else {
+        executeUnknownCommand(line);
+    }
+}
+
+/*
+ * Given a parsed command (simple or composed), executes it and waits for it to
+ * complete.
+ * @param line The parsed line
+ */
+void executeUnknownCommand(ParsedLine* line) {
+    char** argvs[line->numCommands];
+    for (int i = 0; i < line->numCommands; i++) {
+        argvs[i] = &line->words[line->starts[i]];
+    }
+    if (line->numCommands > 1) {
+        executeComposedCommand(argvs, line->redirections, line->numCommands);
+    } else {
+        executeCommand(argvs[0], &line->redirections[0]);
     }
 }
@@ -1,5 +1,8 @@
 /**
- * A simple program to read M characters one by one.
+ * A simple program to read M characters. By default the characters are read one by
+ * one; with a chunk size C they are read up to C at a time, and with K iovecs each
+ * readv() call reads into K chunks. The throughput is reported on stderr. Given a ring
+ * name the characters come from a shared memory ring (see ring.h) instead of stdin.
  * @author Efe Acer
  * @version 1.0
  */
@@ -7,22 +10,81 @@
 // Necessary imports
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "ring.h"
 
 // Definitions
 #define STDIN_FD 0
+#define MAX_IOVECS 1024
 
 // Global Variables
 int M = 10;
+int C = 1; // chunk size, bytes per read() (per iovec with readv)
+int K = 0; // iovecs per readv(), 0 uses read()
+Ring* ring = NULL; // shared memory ring used instead of stdin
 
 // Main function
 int main(int argc, char* argv[]) {
     if (argc > 1) {
         M = atoi(argv[1]); // get the value of M (will be used in experiments)
     }
-    int bytesRead = 0;
+    if (argc > 2) {
+        C = atoi(argv[2]); // get the value of C (will be used in experiments)
+    }
+    if (argc > 3) {
+        K = atoi(argv[3]); // get the value of K (will be used in experiments)
+    }
+    if (C < 1 || K < 0 || K > MAX_IOVECS) {
+        fprintf(stderr, "Usage: %s [M] [chunk size] [iovecs per readv (0 for read)] [ring name]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 4) {
+        ring = ringOpen(argv[4], 0); // shared memory transport
+        if (ring == NULL) {
+            return 1;
+        }
+    }
+    int batch = (K > 0) ? K : 1; // chunks per call
+    char* buffer = malloc((size_t) C * batch);
+    if (buffer == NULL) {
+        fprintf(stderr, "Cannot allocate the buffer.\n");
+        return 1;
+    }
+    struct iovec iovecs[batch];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long bytesRead = 0;
     while (bytesRead < M) {
-        char toRead;
-        bytesRead += read(STDIN_FD, &toRead , 1);
+        long remaining = M - bytesRead;
+        int size = (remaining < (long) C * batch) ? (int) remaining : C * batch;
+        long received;
+        if (ring != NULL) {
+            received = ringRead(ring, buffer, size);
+        } else if (K > 0) {
+            int numIovecs = 0;
+            for (int offset = 0; offset < size; offset += C) {
+                iovecs[numIovecs].iov_base = buffer + offset;
+                iovecs[numIovecs++].iov_len = (size - offset < C) ? size - offset : C;
+            }
+            received = readv(STDIN_FD, iovecs, numIovecs);
+        } else {
+            received = read(STDIN_FD, buffer, size);
+        }
+        if (received <= 0) {
+            break; // end of input before M characters
+        }
+        bytesRead += received;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "consumer: %ld bytes in %.6f s, %.2f MB/s\n", bytesRead, seconds,
+            (seconds > 0) ? bytesRead / seconds / 1e6 : 0.0);
+    if (ring != NULL) {
+        ringClose(ring);
+        ringUnlink(argv[4]); // the next pair starts with a new ring
     }
+    free(buffer);
     return 0;
 }
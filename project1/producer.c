@@ -1,5 +1,9 @@
 /**
- * A simple program to print M random alphanumeric characters to screen one by one.
+ * A simple program to print M random alphanumeric characters to screen. By default the
+ * characters are written one by one; with a chunk size C they are written C at a time,
+ * and with K iovecs each writev() call writes K chunks. The characters are generated
+ * with a xorshift generator and the throughput is reported on stderr. Given a ring name
+ * the characters go to a shared memory ring (see ring.h) instead of stdout.
  * @author Efe Acer
  * @version 1.0
  */
@@ -7,11 +11,16 @@
 // Necessary imports
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <time.h>
+#include <sys/uio.h>
+#include "ring.h"
 
 // Definitions
 #define STDOUT_FD 1
 #define ALPHANUMERIC_SIZE 36
+#define MAX_IOVECS 1024
 
 // Contant(s)
 const char ALPHANUMERIC_CHARS[ALPHANUMERIC_SIZE] = { 'a', 'b', 'c', 'd', 'e', 'f',
@@ -20,17 +29,117 @@ const char ALPHANUMERIC_CHARS[ALPHANUMERIC_SIZE] = { 'a', 'b', 'c', 'd', 'e', 'f
 
 // Global Variables
 int M = 1000;
+int C = 1; // chunk size, bytes per write() (per iovec with writev)
+int K = 0; // iovecs per writev(), 0 uses write()
+Ring* ring = NULL; // shared memory ring used instead of stdout
+uint64_t state; // state of the xorshift generator
+
+// Funtion declerations
+void fillRandom(char buffer[], int size);
+long writeAll(char buffer[], int size);
 
 // Main function
 int main(int argc, char* argv[]) {
     if (argc > 1) {
         M = atoi(argv[1]); // get the value of M (will be used in experiments)
     }
-    srand(time(NULL)); // set random seed
-    int bytesWritten = 0;
+    if (argc > 2) {
+        C = atoi(argv[2]); // get the value of C (will be used in experiments)
+    }
+    if (argc > 3) {
+        K = atoi(argv[3]); // get the value of K (will be used in experiments)
+    }
+    if (C < 1 || K < 0 || K > MAX_IOVECS) {
+        fprintf(stderr, "Usage: %s [M] [chunk size] [iovecs per writev (0 for write)] [ring name]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 4) {
+        ring = ringOpen(argv[4], 1); // shared memory transport
+        if (ring == NULL) {
+            return 1;
+        }
+    }
+    state = (uint64_t) time(NULL) * 0x9E3779B97F4A7C15ULL | 1; // set random seed, never 0
+    int batch = (K > 0) ? K : 1; // chunks per call
+    char* buffer = malloc((size_t) C * batch);
+    if (buffer == NULL) {
+        fprintf(stderr, "Cannot allocate the buffer.\n");
+        return 1;
+    }
+    struct iovec iovecs[batch];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long bytesWritten = 0;
     while (bytesWritten < M) {
-        char randomChar = ALPHANUMERIC_CHARS[rand() % ALPHANUMERIC_SIZE];
-        bytesWritten += write(STDOUT_FD, &randomChar, 1);
+        long remaining = M - bytesWritten;
+        int size = (remaining < (long) C * batch) ? (int) remaining : C * batch;
+        fillRandom(buffer, size);
+        long written;
+        if (ring != NULL) {
+            written = ringWrite(ring, buffer, size);
+        } else if (K > 0) {
+            int numIovecs = 0;
+            for (int offset = 0; offset < size; offset += C) {
+                iovecs[numIovecs].iov_base = buffer + offset;
+                iovecs[numIovecs++].iov_len = (size - offset < C) ? size - offset : C;
+            }
+            written = writev(STDOUT_FD, iovecs, numIovecs);
+            if (written > 0 && written < size) { // the chunks are contiguous in buffer
+                long rest = writeAll(buffer + written, size - written);
+                written = (rest < 0) ? rest : written + rest;
+            }
+        } else {
+            written = writeAll(buffer, size);
+        }
+        if (written <= 0) {
+            break; // the reader is gone
+        }
+        bytesWritten += written;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "producer: %ld bytes in %.6f s, %.2f MB/s\n", bytesWritten, seconds,
+            (seconds > 0) ? bytesWritten / seconds / 1e6 : 0.0);
+    if (ring != NULL) {
+        ringClose(ring);
     }
+    free(buffer);
     return 0;
 }
+
+/**
+ * Fills a buffer with random alphanumeric characters, taking 8 characters from
+ * each 64 bit output of a xorshift generator.
+ * @param buffer The buffer
+ * @param size Number of characters
+ */
+void fillRandom(char buffer[], int size) {
+    for (int i = 0; i < size; i += 8) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint64_t bits = state;
+        for (int j = i; j < i + 8 && j < size; j++) {
+            buffer[j] = ALPHANUMERIC_CHARS[((bits & 0xFF) * ALPHANUMERIC_SIZE) >> 8];
+            bits >>= 8;
+        }
+    }
+}
+
+/**
+ * Writes a whole buffer to stdout, calling write() again after a partial write.
+ * @param buffer The buffer
+ * @param size Number of bytes
+ * @return Number of bytes written, -1 if nothing could be written
+ */
+long writeAll(char buffer[], int size) {
+    long total = 0;
+    while (total < size) {
+        long written = write(STDOUT_FD, buffer + total, size - total);
+        if (written <= 0) {
+            return (total > 0) ? total : -1;
+        }
+        total += written;
+    }
+    return total;
+}
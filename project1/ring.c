@@ -0,0 +1,238 @@
+/**
+ * Implementation of the shared memory ring buffer (see ring.h). The producer only
+ * advances head and the consumer only advances tail, so the ring needs no lock. A
+ * side that cannot make progress announces itself in its waiting flag, checks the
+ * ring once more and then sleeps on its wakeup counter; the other side increments
+ * the counter and calls FUTEX_WAKE after an update only when the flag is set.
+ * @author Efe Acer
+ * @version 1.0
+ */
+
+// Necessary imports
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "ring.h"
+
+// Funtion declerations
+int waitCreated(const char* name);
+int canProceed(Ring* ring);
+void waitOther(Ring* ring);
+void wakeOther(Ring* ring);
+
+/**
+ * Opens the ring with the given name. The producer owns the ring: it removes any
+ * object left under the name by an earlier pair (e.g. one that crashed) and creates
+ * a new one, which is zero filled and so an empty ring. The consumer only opens the
+ * ring the producer created, so the producer must be started first; the consumer
+ * waits up to RING_OPEN_WAIT_MS for it, so both can also be started together.
+ * @param name The name of the shared memory object, e.g. "/ring"
+ * @param isProducer 1 for the producer, 0 for the consumer
+ * @return The ring, NULL on error
+ */
+Ring* ringOpen(const char* name, int isProducer) {
+    int fd;
+    if (isProducer) {
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd == -1) {
+            perror("shm_open");
+            return NULL;
+        }
+        if (ftruncate(fd, sizeof(RingShared)) == -1) {
+            perror("ftruncate");
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    } else if ((fd = waitCreated(name)) == -1) {
+        return NULL;
+    }
+    void* shared = mmap(NULL, sizeof(RingShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    Ring* ring = malloc(sizeof(Ring));
+    if (ring == NULL) {
+        munmap(shared, sizeof(RingShared));
+        return NULL;
+    }
+    ring->shared = shared;
+    ring->isProducer = isProducer;
+    ring->spins = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? RING_SPINS : 0;
+    return ring;
+}
+
+/**
+ * Opens a ring for the consumer once the producer has created it and set its size,
+ * polling every millisecond for up to RING_OPEN_WAIT_MS.
+ * @param name The name of the shared memory object
+ * @return The descriptor of the shared memory object, -1 on error
+ */
+int waitCreated(const char* name) {
+    for (int waited = 0; waited <= RING_OPEN_WAIT_MS; waited++) {
+        int fd = shm_open(name, O_RDWR, 0);
+        if (fd == -1 && errno != ENOENT) {
+            perror("shm_open");
+            return -1;
+        }
+        struct stat status;
+        if (fd != -1 && fstat(fd, &status) == 0 && status.st_size == sizeof(RingShared)) {
+            return fd;
+        }
+        if (fd != -1) {
+            close(fd); // not truncated yet
+        }
+        usleep(1000);
+    }
+    fprintf(stderr, "Ring %s was not created, start the producer first.\n", name);
+    return -1;
+}
+
+/**
+ * Writes a whole buffer to the ring, waiting while the ring is full.
+ * @param ring The ring, opened by the producer
+ * @param buffer The buffer
+ * @param size Number of bytes
+ * @return Number of bytes written, less than size if the consumer closed the ring
+ */
+long ringWrite(Ring* ring, const char* buffer, long size) {
+    RingShared* shared = ring->shared;
+    long total = 0;
+    while (total < size) {
+        uint32_t head = shared->head; // only this side writes head
+        uint32_t space = RING_SIZE - (head - __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE));
+        if (__atomic_load_n(&shared->detached, __ATOMIC_ACQUIRE)) {
+            break; // nobody will read the rest
+        }
+        if (space == 0) {
+            waitOther(ring);
+            continue;
+        }
+        uint32_t count = (size - total < space) ? (uint32_t) (size - total) : space;
+        uint32_t offset = head & (RING_SIZE - 1);
+        uint32_t first = (count < RING_SIZE - offset) ? count : RING_SIZE - offset;
+        memcpy(shared->data + offset, buffer + total, first);
+        memcpy(shared->data, buffer + total + first, count - first); // wrapped part
+        __atomic_store_n(&shared->head, head + count, __ATOMIC_SEQ_CST);
+        wakeOther(ring);
+        total += count;
+    }
+    return total;
+}
+
+/**
+ * Reads up to size bytes from the ring, waiting while the ring is empty.
+ * @param ring The ring, opened by the consumer
+ * @param buffer The buffer
+ * @param size Size of the buffer
+ * @return Number of bytes read, 0 if the producer closed the ring and it is empty
+ */
+long ringRead(Ring* ring, char* buffer, long size) {
+    RingShared* shared = ring->shared;
+    while (1) {
+        uint32_t tail = shared->tail; // only this side writes tail
+        uint32_t available = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE) - tail;
+        if (available == 0) {
+            if (__atomic_load_n(&shared->closed, __ATOMIC_ACQUIRE)
+                && __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE) == tail) {
+                return 0; // head is published before closed
+            }
+            waitOther(ring);
+            continue;
+        }
+        uint32_t count = (size < available) ? (uint32_t) size : available;
+        uint32_t offset = tail & (RING_SIZE - 1);
+        uint32_t first = (count < RING_SIZE - offset) ? count : RING_SIZE - offset;
+        memcpy(buffer, shared->data + offset, first);
+        memcpy(buffer + first, shared->data, count - first); // wrapped part
+        __atomic_store_n(&shared->tail, tail + count, __ATOMIC_SEQ_CST);
+        wakeOther(ring);
+        return count;
+    }
+}
+
+/**
+ * Unmaps the ring. When the producer closes the ring the consumer reads the
+ * remaining bytes and then gets end of file; when the consumer closes it the
+ * producer stops writing, as with a broken pipe.
+ * @param ring The ring
+ */
+void ringClose(Ring* ring) {
+    __atomic_store_n(ring->isProducer ? &ring->shared->closed : &ring->shared->detached, 1,
+                     __ATOMIC_SEQ_CST);
+    wakeOther(ring);
+    munmap(ring->shared, sizeof(RingShared));
+    free(ring);
+}
+
+/**
+ * Removes the name of a ring, the rings that are open stay usable.
+ * @param name The name of the shared memory object
+ */
+void ringUnlink(const char* name) {
+    shm_unlink(name);
+}
+
+/**
+ * Checks whether the side of the ring can make progress: the producer when there
+ * is free space or the consumer is gone, the consumer when there are bytes or the
+ * producer is gone.
+ * @param ring The ring
+ * @return 1 if the side can proceed, 0 otherwise
+ */
+int canProceed(Ring* ring) {
+    RingShared* shared = ring->shared;
+    uint32_t used = __atomic_load_n(&shared->head, __ATOMIC_SEQ_CST)
+        - __atomic_load_n(&shared->tail, __ATOMIC_SEQ_CST);
+    if (ring->isProducer) {
+        return used < RING_SIZE || __atomic_load_n(&shared->detached, __ATOMIC_SEQ_CST);
+    }
+    return used > 0 || __atomic_load_n(&shared->closed, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Waits until the other side updates the ring, spinning (on a multiprocessor) before
+ * sleeping on the futex. The wakeup counter is read before the last check, so an
+ * update that the check misses changes the counter and FUTEX_WAIT returns at once.
+ * @param ring The ring
+ */
+void waitOther(Ring* ring) {
+    RingShared* shared = ring->shared;
+    for (int i = 0; i < ring->spins; i++) {
+        if (canProceed(ring)) {
+            return;
+        }
+    }
+    uint32_t* waiting = ring->isProducer ? &shared->producerWaiting : &shared->consumerWaiting;
+    uint32_t* wakeups = ring->isProducer ? &shared->producerWakeups : &shared->consumerWakeups;
+    uint32_t seen = __atomic_load_n(wakeups, __ATOMIC_SEQ_CST);
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (!canProceed(ring)) {
+        syscall(SYS_futex, wakeups, FUTEX_WAIT, seen, NULL, NULL, 0);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Wakes the other side if it is waiting, called after every update of the ring.
+ * @param ring The ring
+ */
+void wakeOther(Ring* ring) {
+    RingShared* shared = ring->shared;
+    uint32_t* waiting = ring->isProducer ? &shared->consumerWaiting : &shared->producerWaiting;
+    uint32_t* wakeups = ring->isProducer ? &shared->consumerWakeups : &shared->producerWakeups;
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(wakeups, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, wakeups, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
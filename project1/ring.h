@@ -0,0 +1,47 @@
+/**
+ * A single producer, single consumer ring buffer in POSIX shared memory. The producer
+ * and the consumer open the ring by name (shm_open + mmap) and exchange bytes without
+ * system calls while the ring is neither empty nor full; a side that has to wait
+ * spins briefly and then sleeps on a futex in the shared mapping. The producer creates
+ * the ring, so it has to be started first (see ringOpen).
+ * @author Efe Acer
+ * @version 1.0
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+// Definitions
+#define RING_SIZE (1 << 20) // capacity in bytes, a power of 2
+#define RING_SPINS 1000 // polls of the other side before sleeping (multiprocessors only)
+#define RING_OPEN_WAIT_MS 1000 // how long the consumer waits for the producer to create the ring
+
+// Shared part of a ring, all zeros is an empty ring
+typedef struct {
+    _Alignas(64) uint32_t head; // bytes written so far (mod 2^32), advanced by the producer
+    uint32_t closed; // the producer will not write anymore
+    uint32_t consumerWaiting; // the consumer is about to sleep on consumerWakeups
+    uint32_t consumerWakeups; // futex word of the consumer, incremented to wake it
+    _Alignas(64) uint32_t tail; // bytes read so far (mod 2^32), advanced by the consumer
+    uint32_t detached; // the consumer will not read anymore
+    uint32_t producerWaiting; // the producer is about to sleep on producerWakeups
+    uint32_t producerWakeups; // futex word of the producer, incremented to wake it
+    _Alignas(64) char data[RING_SIZE];
+} RingShared;
+
+typedef struct {
+    RingShared* shared;
+    int isProducer;
+    int spins; // RING_SPINS, 0 on a uniprocessor where the other side cannot run meanwhile
+} Ring;
+
+// Funtion declerations
+Ring* ringOpen(const char* name, int isProducer);
+long ringWrite(Ring* ring, const char* buffer, long size);
+long ringRead(Ring* ring, char* buffer, long size);
+void ringClose(Ring* ring);
+void ringUnlink(const char* name);
+
+#endif
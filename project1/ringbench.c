@@ -0,0 +1,297 @@
+/**
+ * A benchmark comparing three transports between two processes: a pipe (write() and
+ * read()), a pipe filled with vmsplice() (the pages of the sender are referenced by the
+ * pipe instead of copied into it, the receiver uses read()) and the shared memory ring
+ * of ring.h. For each message size the throughput of sending T megabytes and the round
+ * trip time of R ping-pong exchanges are measured, a CSV line is printed per pair.
+ * @author Efe Acer
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+
+// Necessary imports
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include "ring.h"
+
+// Definitions
+#define METHOD_PIPE 0
+#define METHOD_SPLICE 1
+#define METHOD_RING 2
+#define READ_END 0
+#define WRITE_END 1
+#define NUM_SIZES 5
+
+// Contant(s)
+const char* METHOD_NAMES[] = {"pipe", "splice", "ring"};
+const int MESSAGE_SIZES[NUM_SIZES] = {64, 512, 4096, 65536, 262144};
+
+// One direction of communication between the two processes
+typedef struct {
+    int method;
+    int fds[2]; // the pipe of METHOD_PIPE and METHOD_SPLICE
+    char name[64]; // the shared memory object of METHOD_RING
+    Ring* ring;
+} Channel;
+
+// Global Variables
+int T = 256; // megabytes sent per throughput run
+int R = 10000; // round trips per latency run
+char* buffer;
+
+// Funtion declerations
+void channelInit(Channel* channel, int method, int id);
+void channelOpen(Channel* channel, int isSender);
+long channelSend(Channel* channel, char data[], long size);
+long channelReceive(Channel* channel, char data[], long size);
+void channelClose(Channel* channel);
+void channelRemove(Channel* channel);
+double measureThroughput(int method, int size);
+double measureRoundTrip(int method, int size);
+double elapsed(struct timespec* start);
+
+// Main function
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        T = atoi(argv[1]); // get the value of T (will be used in experiments)
+    }
+    if (argc > 2) {
+        R = atoi(argv[2]); // get the value of R (will be used in experiments)
+    }
+    if (T < 1 || R < 1) {
+        fprintf(stderr, "Usage: %s [megabytes per run] [round trips]\n", argv[0]);
+        return 1;
+    }
+    buffer = aligned_alloc(4096, MESSAGE_SIZES[NUM_SIZES - 1]);
+    if (buffer == NULL) {
+        fprintf(stderr, "Cannot allocate the buffer.\n");
+        return 1;
+    }
+    memset(buffer, 'a', MESSAGE_SIZES[NUM_SIZES - 1]); // never changed, vmsplice can reference it
+    printf("transport,message_bytes,mb_per_s,rtt_us\n");
+    for (int i = 0; i < NUM_SIZES; i++) {
+        for (int method = METHOD_PIPE; method <= METHOD_RING; method++) {
+            double throughput = measureThroughput(method, MESSAGE_SIZES[i]);
+            double roundTrip = measureRoundTrip(method, MESSAGE_SIZES[i]);
+            printf("%s,%d,%.1f,%.2f\n", METHOD_NAMES[method], MESSAGE_SIZES[i], throughput, roundTrip);
+            fflush(stdout); // the children must not inherit buffered lines
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+/**
+ * Creates a channel before fork(). Pipes get the capacity of a ring so that the
+ * transports buffer the same amount of data.
+ * @param channel The channel
+ * @param method One of METHOD_PIPE, METHOD_SPLICE and METHOD_RING
+ * @param id Number of the channel, makes the ring names unique
+ */
+void channelInit(Channel* channel, int method, int id) {
+    channel->method = method;
+    channel->ring = NULL;
+    if (method == METHOD_RING) {
+        sprintf(channel->name, "/ringbench.%d.%d", getpid(), id);
+        ringUnlink(channel->name); // start with an empty ring
+        return;
+    }
+    if (pipe(channel->fds) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    fcntl(channel->fds[WRITE_END], F_SETPIPE_SZ, RING_SIZE); // best effort
+}
+
+/**
+ * Opens the end of a channel used by the calling process after fork().
+ * @param channel The channel
+ * @param isSender 1 for the sending end, 0 for the receiving end
+ */
+void channelOpen(Channel* channel, int isSender) {
+    if (channel->method == METHOD_RING) {
+        channel->ring = ringOpen(channel->name, isSender);
+        if (channel->ring == NULL) {
+            exit(1);
+        }
+        return;
+    }
+    close(channel->fds[isSender ? READ_END : WRITE_END]);
+}
+
+/**
+ * Sends a whole message over a channel.
+ * @param channel The channel, opened as the sender
+ * @param data The message
+ * @param size Size of the message
+ * @return Number of bytes sent
+ */
+long channelSend(Channel* channel, char data[], long size) {
+    if (channel->method == METHOD_RING) {
+        return ringWrite(channel->ring, data, size);
+    }
+    long total = 0;
+    while (total < size) {
+        long sent;
+        if (channel->method == METHOD_SPLICE) {
+            struct iovec iov = {data + total, size - total};
+            sent = vmsplice(channel->fds[WRITE_END], &iov, 1, 0);
+        } else {
+            sent = write(channel->fds[WRITE_END], data + total, size - total);
+        }
+        if (sent <= 0) {
+            break;
+        }
+        total += sent;
+    }
+    return total;
+}
+
+/**
+ * Receives a whole message from a channel.
+ * @param channel The channel, opened as the receiver
+ * @param data The buffer of the message
+ * @param size Size of the message
+ * @return Number of bytes received, less than size at end of file
+ */
+long channelReceive(Channel* channel, char data[], long size) {
+    long total = 0;
+    while (total < size) {
+        long received;
+        if (channel->method == METHOD_RING) {
+            received = ringRead(channel->ring, data + total, size - total);
+        } else {
+            received = read(channel->fds[READ_END], data + total, size - total);
+        }
+        if (received <= 0) {
+            break;
+        }
+        total += received;
+    }
+    return total;
+}
+
+/**
+ * Closes the end of a channel opened by the calling process.
+ * @param channel The channel
+ */
+void channelClose(Channel* channel) {
+    if (channel->method == METHOD_RING) {
+        ringClose(channel->ring);
+        return;
+    }
+    close(channel->fds[READ_END]); // one of them is already closed
+    close(channel->fds[WRITE_END]);
+}
+
+/**
+ * Removes the shared memory object of a ring channel, called once both processes
+ * are done with it.
+ * @param channel The channel
+ */
+void channelRemove(Channel* channel) {
+    if (channel->method == METHOD_RING) {
+        ringUnlink(channel->name);
+    }
+}
+
+/**
+ * A child process sends T megabytes in messages of the given size, the parent
+ * receives them.
+ * @param method One of METHOD_PIPE, METHOD_SPLICE and METHOD_RING
+ * @param size Size of a message
+ * @return The throughput in megabytes per second
+ */
+double measureThroughput(int method, int size) {
+    long total = (long) T << 20;
+    Channel channel;
+    channelInit(&channel, method, 0);
+    pid_t pid = fork();
+    if (pid == 0) { // child
+        channelOpen(&channel, 1);
+        for (long sent = 0; sent < total; sent += size) {
+            channelSend(&channel, buffer, (total - sent < size) ? total - sent : size);
+        }
+        channelClose(&channel);
+        _exit(0);
+    }
+    char* data = malloc(size);
+    channelOpen(&channel, 0);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long received = 0;
+    long count;
+    while ((count = channelReceive(&channel, data, size)) > 0) {
+        received += count;
+    }
+    double seconds = elapsed(&start);
+    channelClose(&channel);
+    waitpid(pid, NULL, 0);
+    channelRemove(&channel);
+    free(data);
+    if (received != total) {
+        fprintf(stderr, "%s: received %ld of %ld bytes.\n", METHOD_NAMES[method], received, total);
+    }
+    return received / seconds / 1e6;
+}
+
+/**
+ * The parent sends a message of the given size to a child process which sends it
+ * back, R times.
+ * @param method One of METHOD_PIPE, METHOD_SPLICE and METHOD_RING
+ * @param size Size of a message
+ * @return The mean round trip time in microseconds
+ */
+double measureRoundTrip(int method, int size) {
+    Channel request, response;
+    channelInit(&request, method, 1);
+    channelInit(&response, method, 2);
+    char* data = malloc(size);
+    pid_t pid = fork();
+    if (pid == 0) { // child
+        channelOpen(&request, 0);
+        channelOpen(&response, 1);
+        while (channelReceive(&request, data, size) == size) {
+            channelSend(&response, data, size); // send back what was received
+        }
+        channelClose(&request);
+        channelClose(&response);
+        _exit(0);
+    }
+    channelOpen(&request, 1);
+    channelOpen(&response, 0);
+    channelSend(&request, buffer, size); // warm up
+    channelReceive(&response, data, size);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < R; i++) {
+        channelSend(&request, buffer, size);
+        channelReceive(&response, data, size);
+    }
+    double seconds = elapsed(&start);
+    channelClose(&request);
+    channelClose(&response);
+    waitpid(pid, NULL, 0);
+    channelRemove(&request);
+    channelRemove(&response);
+    free(data);
+    return seconds * 1e6 / R;
+}
+
+/**
+ * Returns the time passed since start.
+ * @param start The start time
+ * @return The elapsed time in seconds
+ */
+double elapsed(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,103 @@
+/**
+ * A microbenchmark comparing the ways a shell can launch a command: fork() + execv(),
+ * vfork() + execv() and posix_spawn(). Each method launches /bin/true L times and
+ * waits for it, the mean launch latency is printed per method. The shell can be made
+ * larger with a ballast of B megabytes of touched memory, since fork() has to copy the
+ * page tables of the whole process.
+ * @author Efe Acer
+ * @version 1.0
+ */
+
+// Necessary imports
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <spawn.h>
+#include <time.h>
+
+// Definitions
+#define METHOD_FORK 0
+#define METHOD_VFORK 1
+#define METHOD_SPAWN 2
+
+// Contant(s)
+const char* METHOD_NAMES[] = {"fork", "vfork", "posix_spawn"};
+
+// Global Variables
+int L = 1000; // number of launches per method
+int B = 0; // ballast in megabytes
+char* program[] = {"/bin/true", NULL};
+extern char** environ;
+
+// Funtion declerations
+pid_t launch(int method);
+double measure(int method);
+
+// Main function
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        L = atoi(argv[1]); // get the value of L (will be used in experiments)
+    }
+    if (argc > 2) {
+        B = atoi(argv[2]); // get the value of B (will be used in experiments)
+    }
+    if (L < 1 || B < 0) {
+        fprintf(stderr, "Usage: %s [launches] [ballast in MB]\n", argv[0]);
+        return 1;
+    }
+    char* ballast = NULL;
+    if (B > 0) {
+        ballast = malloc((size_t) B << 20);
+        if (ballast == NULL) {
+            fprintf(stderr, "Cannot allocate the ballast.\n");
+            return 1;
+        }
+        memset(ballast, 1, (size_t) B << 20); // touch every page
+    }
+    printf("method,launches,ballast_mb,us_per_launch\n");
+    for (int method = METHOD_FORK; method <= METHOD_SPAWN; method++) {
+        printf("%s,%d,%d,%.1f\n", METHOD_NAMES[method], L, B, measure(method));
+    }
+    free(ballast);
+    return 0;
+}
+
+/**
+ * Launches the program with the given method without waiting for it.
+ * @param method One of METHOD_FORK, METHOD_VFORK and METHOD_SPAWN
+ * @return The process id of the child, -1 on failure
+ */
+pid_t launch(int method) {
+    pid_t pid;
+    if (method == METHOD_SPAWN) {
+        return (posix_spawn(&pid, program[0], NULL, NULL, program, environ) == 0) ? pid : -1;
+    }
+    pid = (method == METHOD_FORK) ? fork() : vfork();
+    if (pid == 0) { // child
+        execv(program[0], program);
+        _exit(127);
+    }
+    return pid;
+}
+
+/**
+ * Launches the program L times with the given method, waiting for each launch.
+ * @param method One of METHOD_FORK, METHOD_VFORK and METHOD_SPAWN
+ * @return The mean time of a launch in microseconds
+ */
+double measure(int method) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < L; i++) {
+        pid_t pid = launch(method);
+        if (pid < 0) {
+            fprintf(stderr, "Launch failed.\n");
+            exit(1);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / L;
+}
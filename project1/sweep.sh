@@ -0,0 +1,43 @@
+#!/bin/bash
+# Runs the composed command "./producer M | ./consumer M" in bilshell's batch mode for
+# every value of N (relay buffer size, 0 connects the commands directly) and M (number
+# of characters), REPEATS times each, and prints a CSV line per point with the mean and
+# standard deviation of the wall time and the mean read/write call counts of the relay.
+# CHUNK is the chunk size of producer and consumer (1 writes and reads characters one
+# by one). The values can be overridden from the environment, e.g.
+#	NS="0 4096" MS="1000000" REPEATS=10 CHUNK=4096 ./sweep.sh
+# @author Efe Acer
+# @version 1.0
+
+NS=${NS:-"0 1 64 4096 65536"}
+MS=${MS:-"10000 100000 1000000"}
+REPEATS=${REPEATS:-5}
+CHUNK=${CHUNK:-1}
+
+batch=$(mktemp)
+output=$(mktemp)
+trap 'rm -f "$batch" "$output"' EXIT
+
+echo "n,m,repeats,wall_mean_s,wall_stddev_s,read_calls,write_calls"
+for n in $NS; do
+	for m in $MS; do
+		echo "./producer $m $CHUNK | ./consumer $m $CHUNK" > "$batch"
+		for ((r = 0; r < REPEATS; r++)); do
+			start=$(date +%s%N)
+			./bilshell "$n" "$batch" > "$output" 2> /dev/null
+			end=$(date +%s%N)
+			# one line per run: wall time, read calls, write calls (0 when nothing is relayed)
+			awk -v ns=$((end - start)) '
+				/^read-call-count:/ { reads = $2 }
+				/^write-call-count:/ { writes = $2 }
+				END { printf "%.9f %d %d\n", ns / 1e9, reads, writes }' "$output"
+		done | awk -v n="$n" -v m="$m" '
+			{ sum += $1; squares += $1 * $1; reads += $2; writes += $3; count++ }
+			END {
+				mean = sum / count
+				variance = (count > 1) ? (squares - count * mean * mean) / (count - 1) : 0
+				printf "%s,%s,%d,%.6f,%.6f,%.1f,%.1f\n", n, m, count, mean,
+					sqrt(variance > 0 ? variance : 0), reads / count, writes / count
+			}'
+	done
+done
@@ -20,6 +20,7 @@
 
 // Function Declerations
 void *aprocess(void *p);
+void report_deadlock(int procarray[], int num_deadlocked);
 
 // Global Variables
 int handling_method; // deadlock handling method
@@ -39,6 +40,10 @@ int main(int argc, char** argv) {
     // Change the handling method here !!!
     handling_method = DEADLOCK_AVOIDANCE;
     ralloc_init(N, M, exist, handling_method);
+    if (handling_method == DEADLOCK_DETECTION) {
+        ralloc_detection_handler(report_deadlock); // reported as soon as it forms
+        ralloc_recovery(RECOVERY_MIN_HELD); // victims give up their allocations
+    }
     printf("Library initialized.\n");
     
     for (int i = 0; i < N; ++i) {
@@ -88,6 +93,15 @@ int main(int argc, char** argv) {
     return 0;
 }
 
+void report_deadlock(int procarray[], int num_deadlocked) {
+    printf("Deadlock formed, %d processes are deadlocked.\nProcess id(s): ", num_deadlocked);
+    for (int i = 0; i < N; i++) {
+        if (procarray[i] == 1) {
+            printf("%d ", i);
+        }
+    }
+    printf("\n");
+}
 
 void *aprocess(void *p) {
     int pid =  *((int*) &p);
@@ -103,12 +117,16 @@ void *aprocess(void *p) {
             rand() % (max_demand[0] + 1),
             rand() % (max_demand[1] + 1),
             rand() % (max_demand[2] + 1)};
-        ralloc_request(pid, first_demand);
+        if (ralloc_request(pid, first_demand) == RALLOC_ABORTED) {
+            continue; // everything allocated is reclaimed, start over
+        }
         int second_demand[] = {
             rand() % (max_demand[0] - first_demand[0] + 1),
             rand() % (max_demand[1] - first_demand[1] + 1),
             rand() % (max_demand[2] - first_demand[2] + 1)};
-        ralloc_request(pid, second_demand);
+        if (ralloc_request(pid, second_demand) == RALLOC_ABORTED) {
+            continue;
+        }
         ralloc_release(pid, first_demand);
         ralloc_release(pid, second_demand);
     }
@@ -118,14 +136,16 @@ void *aprocess(void *p) {
             rand() % (max_demand[0] + 1),
             rand() % (max_demand[1] + 1),
             rand() % (max_demand[2] + 1)};
-        ralloc_request(pid, first_demand);
-        ralloc_release(pid, first_demand);
+        if (ralloc_request(pid, first_demand) != RALLOC_ABORTED) {
+            ralloc_release(pid, first_demand);
+        }
         int second_demand[] = {
             rand() % (max_demand[0] + 1),
             rand() % (max_demand[1] + 1),
             rand() % (max_demand[2] + 1)};
-        ralloc_request(pid, second_demand);
-        ralloc_release(pid, second_demand);
+        if (ralloc_request(pid, second_demand) != RALLOC_ABORTED) {
+            ralloc_release(pid, second_demand);
+        }
     }
     
     terminated[pid] = 1; // process successfully terminates
@@ -1,6 +1,9 @@
 /**
  * CS342 Spring 2019 - Project 3
- * A multithreaded program to make experiments using the resource allocation library (ralloc)
+ * A parameterized benchmark for the resource allocation library (ralloc). Each
+ * process (thread) repeatedly acquires random amounts of random resource types in
+ * one or more stages and then releases everything. Every deadlock handling method
+ * runs the same workload on a fresh context and a CSV line is printed per method.
  * @author Yusuf Dalva - 21602867
  * @author Efe Acer - 21602217
  */
@@ -12,161 +15,262 @@
 #include <stdlib.h>
 #include "pthread.h"
 #include "ralloc.h"
-#include <time.h> // for CPU time measurements
+#include <time.h> // for wall clock measurements
 
-#define M 3 // number of resource types
-#define N 5 // number of processes (threads)
+typedef struct {
+    int pid;
+    int stages; // requests made before releasing everything
+    long* latencies; // grant latency of each request in nanoseconds
+    int num_latencies;
+    int aborts; // number of requests aborted by deadlock recovery
+} Worker;
 
 // Function Declerations
 void *aprocess(void *p);
-void *bprocess(void *p);
+void run_policy(int method);
+void parse_capacities(char* list);
+long wall_time_ns();
+int compare_longs(const void* a, const void* b);
+long percentile(long sorted[], int size, double p);
 
-// Global Variables
-int handling_method; // deadlock handling method
-int exist[M] = {10, 5, 7}; // resources existing in the system
-pthread_t tids[N]; // ids of created threads
+// Global Variables (benchmark parameters)
+int P = 5; // number of processes (threads)
+int R = 3; // number of resource types
+int exist[MAX_RESOURCE_TYPES]; // resources existing in the system
+int ops = 10000; // request/release cycles per process
+int stages = 2; // requests made before releasing everything
+int types_per_request = 1; // resource types touched by each request
+int batching = 0; // check the waiting DEADLOCK_AVOIDANCE requests against one safe sequence
+char* trace_path = NULL; // prefix of the ralloc traces, one file per method
+unsigned int seed = 1;
+ralloc_ctx* ctx; // context of the running method
 
 int main(int argc, char** argv) {
-    // Change the handling method here !!!
-    handling_method = DEADLOCK_DETECTION;
-    ralloc_init(N, M, exist, handling_method);
-    printf ("Library initialized.\n");
-    
-    clock_t start = clock();
-    
-    for (int i = 0; i < N; ++i) {
-        pthread_create(&(tids[i]), NULL, &aprocess, (void*) (size_t) i);
-    }
-    printf("%d processes (threads) are created.\n", N);
-    
-    for (int i = 0; i < N; i++) {
-        pthread_join(tids[i], NULL);
+    int method = 0; // 0 runs every method
+    int header = 1;
+    char* capacities = "10";
+    int opt;
+    while ((opt = getopt(argc, argv, "p:r:c:o:s:k:d:x:bt:n")) != -1) {
+        switch (opt) {
+            case 'p': P = atoi(optarg); break;
+            case 'r': R = atoi(optarg); break;
+            case 'c': capacities = optarg; break;
+            case 'o': ops = atoi(optarg); break;
+            case 's': stages = atoi(optarg); break;
+            case 'k': types_per_request = atoi(optarg); break;
+            case 'd': method = atoi(optarg); break;
+            case 'x': seed = atoi(optarg); break;
+            case 'b': batching = 1; break;
+            case 't': trace_path = optarg; break;
+            case 'n': header = 0; break;
+            default:
+                fprintf(stderr, "Usage: %s [-p processes] [-r resource types] "
+                        "[-c capacity[,capacity...]] [-o cycles per process] [-s stages] "
+                        "[-k types per request] [-d method (0 for all)] [-x seed] "
+                        "[-b (batching)] [-t trace prefix] [-n (no header)]\n", argv[0]);
+                return -1;
+        }
     }
-    printf("Initial state is established.\n");
-    
-    for (int i = 0; i < N; ++i) {
-        pthread_create(&(tids[i]), NULL, &bprocess, (void*) (size_t) i);
+    if (P < 1 || R < 1 || R > MAX_RESOURCE_TYPES || ops < 1 || stages < 1
+        || types_per_request < 1 || types_per_request > R) {
+        fprintf(stderr, "Error: Invalid benchmark parameters.\n");
+        return -1;
     }
-    
-    for (int i = 0; i < N; i++) {
-        pthread_join(tids[i], NULL);
+    parse_capacities(capacities);
+
+    if (header) {
+        printf("method,processes,types,ops,stages,wall_s,cycles_per_s,p50_us,p90_us,"
+               "p99_us,max_us,waits,blocked_s,safety_checks,safety_ns_per_check,aborts,batching,"
+               "fast_path_hit_rate\n");
+    }
+    for (int m = DEADLOCK_NOTHING; m <= DEADLOCK_AVOIDANCE; m++) {
+        if (method == 0 || method == m) {
+            run_policy(m);
+        }
     }
-    printf("All processes terminated without any deadlocks.\n");
-    
-    clock_t end = clock();
-    
-    ralloc_end();
-    
-    double time_elapsed = ((double) (end - start)) / CLOCKS_PER_SEC;
-    
-    printf("Time elapsed (in seconds): %f\n", time_elapsed);
-    
     return 0;
 }
 
+/**
+ * Runs the workload with a deadlock handling method and prints its CSV line.
+ * DEADLOCK_NOTHING cannot recover from deadlocks, so its processes make a single
+ * request per cycle (no hold and wait), DEADLOCK_DETECTION recovers by aborting
+ * the process that holds the fewest resources.
+ * @param method The deadlock handling method
+ */
+void run_policy(int method) {
+    ctx = ralloc_ctx_init(P, R, exist, method);
+    if (ctx == NULL) {
+        exit(1);
+    }
+    if (method == DEADLOCK_DETECTION) {
+        ralloc_ctx_recovery(ctx, RECOVERY_MIN_HELD);
+    }
+    if (method == DEADLOCK_AVOIDANCE) {
+        ralloc_ctx_batching(ctx, batching);
+    }
+    if (trace_path != NULL) {
+        char path[strlen(trace_path) + 16];
+        sprintf(path, "%s.%d", trace_path, method);
+        if (ralloc_ctx_trace(ctx, path) == -1) {
+            exit(1);
+        }
+    }
+    int method_stages = (method == DEADLOCK_NOTHING) ? 1 : stages;
+    pthread_t tids[P];
+    Worker workers[P];
+    for (int i = 0; i < P; i++) {
+        workers[i].pid = i;
+        workers[i].stages = method_stages;
+        workers[i].num_latencies = 0;
+        workers[i].aborts = 0;
+        workers[i].latencies = malloc((size_t) ops * stages * sizeof(long));
+        if (workers[i].latencies == NULL) {
+            fprintf(stderr, "Error: Cannot allocate space for the latencies.\n");
+            exit(1);
+        }
+    }
+
+    long start = wall_time_ns();
+    for (int i = 0; i < P; i++) {
+        pthread_create(&tids[i], NULL, &aprocess, &workers[i]);
+    }
+    for (int i = 0; i < P; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    long end = wall_time_ns();
+
+    // Merge the latencies of the workers
+    int total = 0;
+    int aborts = 0;
+    for (int i = 0; i < P; i++) {
+        total += workers[i].num_latencies;
+        aborts += workers[i].aborts;
+    }
+    long* latencies = malloc((total > 0 ? total : 1) * sizeof(long));
+    if (latencies == NULL) {
+        fprintf(stderr, "Error: Cannot allocate space for the latencies.\n");
+        exit(1);
+    }
+    int k = 0;
+    for (int i = 0; i < P; i++) {
+        memcpy(&latencies[k], workers[i].latencies, workers[i].num_latencies * sizeof(long));
+        k += workers[i].num_latencies;
+        free(workers[i].latencies);
+    }
+    qsort(latencies, total, sizeof(long), compare_longs);
+
+    ralloc_stats stats;
+    ralloc_ctx_stats(ctx, &stats);
+    ralloc_ctx_end(ctx);
+
+    double wall = (end - start) / 1e9;
+    printf("%d,%d,%d,%d,%d,%f,%f,%.3f,%.3f,%.3f,%.3f,%ld,%f,%ld,%.1f,%d,%d,%.3f\n",
+           method, P, R, ops, method_stages, wall, ((double) P * ops) / wall,
+           percentile(latencies, total, 0.50) / 1e3,
+           percentile(latencies, total, 0.90) / 1e3,
+           percentile(latencies, total, 0.99) / 1e3,
+           (total > 0 ? latencies[total - 1] : 0) / 1e3,
+           stats.waits, stats.wait_ns / 1e9, stats.safety_checks,
+           stats.safety_checks > 0 ? (double) stats.safety_ns / stats.safety_checks : 0.0,
+           aborts, method == DEADLOCK_AVOIDANCE && batching,
+           stats.fast_path_hits + stats.fast_path_misses > 0
+               ? (double) stats.fast_path_hits / (stats.fast_path_hits + stats.fast_path_misses) : 0.0);
+    free(latencies);
+}
 
 void *aprocess(void *p) {
-    int pid =  *((int*) &p);
-    
-    int max_demand[M];
-    int request[M];
-    
-    if (pid == 0) {
-        max_demand[0] = 7;
-        max_demand[1] = 5;
-        max_demand[2] = 3;
-        request[0] = 0;
-        request[1] = 1;
-        request[2] = 0;
-    } else if (pid == 1) {
-        max_demand[0] = 3;
-        max_demand[1] = 2;
-        max_demand[2] = 2;
-        request[0] = 2;
-        request[1] = 0;
-        request[2] = 0;
-    } else if (pid == 2) {
-        max_demand[0] = 9;
-        max_demand[1] = 0;
-        max_demand[2] = 2;
-        request[0] = 3;
-        request[1] = 0;
-        request[2] = 2;
-    } else if (pid == 3) {
-        max_demand[0] = 2;
-        max_demand[1] = 2;
-        max_demand[2] = 2;
-        request[0] = 2;
-        request[1] = 1;
-        request[2] = 1;
-    } else if (pid == 4) {
-        max_demand[0] = 4;
-        max_demand[1] = 3;
-        max_demand[2] = 3;
-        request[0] = 0;
-        request[1] = 0;
-        request[2] = 2;
-    }
-    
-    ralloc_maxdemand(pid, max_demand);
-    ralloc_request(pid, request);
-    
-    // pthread_exit(NULL); // causes memory leak
-    return NULL; // this is a better practice
+    Worker* worker = (Worker*) p;
+    int pid = worker->pid;
+    unsigned int rand_state = seed * 7919 + pid; // deterministic per process
+
+    int max_demand[R];
+    for (int i = 0; i < R; i++) {
+        max_demand[i] = 1 + rand_r(&rand_state) % exist[i];
+    }
+    ralloc_ctx_maxdemand(ctx, pid, max_demand);
+
+    int held[R];
+    for (int cycle = 0; cycle < ops; cycle++) {
+        memset(held, 0, sizeof(held));
+        int aborted = 0;
+        for (int s = 0; s < worker->stages && !aborted; s++) {
+            int demand[R];
+            memset(demand, 0, sizeof(demand));
+            for (int t = 0; t < types_per_request; t++) {
+                int type = rand_r(&rand_state) % R;
+                int remaining = max_demand[type] - held[type] - demand[type];
+                demand[type] += rand_r(&rand_state) % (remaining + 1);
+            }
+            long start = wall_time_ns();
+            int result = ralloc_ctx_request(ctx, pid, demand);
+            worker->latencies[worker->num_latencies++] = wall_time_ns() - start;
+            if (result == RALLOC_ABORTED) {
+                worker->aborts++;
+                aborted = 1; // everything held is reclaimed
+            } else if (result == 0) {
+                for (int i = 0; i < R; i++) {
+                    held[i] += demand[i];
+                }
+            }
+        }
+        if (!aborted) {
+            ralloc_ctx_release(ctx, pid, held);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Parses a comma separated list of capacities into exist, the last capacity
+ * is repeated for the remaining resource types.
+ * @param list The list of capacities
+ */
+void parse_capacities(char* list) {
+    char* copy = strdup(list);
+    char* rest = copy;
+    int capacity = 1;
+    for (int i = 0; i < R; i++) {
+        char* token = strsep(&rest, ",");
+        if (token != NULL && strlen(token) > 0) {
+            capacity = atoi(token);
+        }
+        exist[i] = (capacity > 0) ? capacity : 1;
+    }
+    free(copy);
+}
+
+/**
+ * Returns the current wall clock time, unlike clock() it includes the time
+ * the threads spend blocked.
+ * @return The current time in nanoseconds
+ */
+long wall_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
 }
 
-void *bprocess(void *p) {
-    int pid =  *((int*) &p);
-    
-    int max_demand[M];
-    int request[M];
-    
-    if (pid == 0) {
-        max_demand[0] = 7;
-        max_demand[1] = 5;
-        max_demand[2] = 3;
-        request[0] = 7;
-        request[1] = 4;
-        request[2] = 3;
-    } else if (pid == 1) {
-        max_demand[0] = 3;
-        max_demand[1] = 2;
-        max_demand[2] = 2;
-        request[0] = 1;
-        request[1] = 2;
-        request[2] = 2;
-    } else if (pid == 2) {
-        max_demand[0] = 9;
-        max_demand[1] = 0;
-        max_demand[2] = 2;
-        request[0] = 6;
-        request[1] = 0;
-        request[2] = 0;
-    } else if (pid == 3) {
-        max_demand[0] = 2;
-        max_demand[1] = 2;
-        max_demand[2] = 2;
-        request[0] = 0;
-        request[1] = 1;
-        request[2] = 1;
-    } else if (pid == 4) {
-        max_demand[0] = 4;
-        max_demand[1] = 3;
-        max_demand[2] = 3;
-        request[0] = 4;
-        request[1] = 3;
-        request[2] = 1;
-    }
-    
-    if (handling_method == DEADLOCK_DETECTION) {
-        int procarray[N] = {0, 0, 0, 0, 0};
-        ralloc_detection(procarray);
-    }
-    
-    ralloc_request(pid, request);
-    ralloc_release(pid, max_demand);
-    
-    // pthread_exit(NULL); // causes memory leak
-    return NULL; // this is a better practice
+int compare_longs(const void* a, const void* b) {
+    long x = *((const long*) a);
+    long y = *((const long*) b);
+    return (x > y) - (x < y);
 }
 
+/**
+ * Returns a percentile of a sorted array (nearest rank).
+ * @param sorted The sorted array
+ * @param size The size of the array
+ * @param p The percentile in the range [0, 1]
+ * @return The percentile, 0 if the array is empty
+ */
+long percentile(long sorted[], int size, double p) {
+    if (size == 0) {
+        return 0;
+    }
+    int index = (int) (p * size);
+    if (index >= size) {
+        index = size - 1;
+    }
+    return sorted[index];
+}
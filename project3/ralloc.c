@@ -1,7 +1,8 @@
 /**
  * CS342 Spring 2019 - Project 3
  * ralloc: Library for resource allocation with deadlock management mechanism.
- * This files contains the implementation of the ralloc interface.
+ * This files contains the implementation of the ralloc interface. Every allocator
+ * lives in its own ralloc_ctx, the ralloc_* functions use a default context.
  * @author Yusuf Dalva - 21602867
  * @author Efe Acer - 21602217
  */
@@ -9,8 +10,14 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <time.h>
 #include "ralloc.h"
 
+// States of a waiting DEADLOCK_AVOIDANCE request, see wake_pending
+#define WAKE_NONE 0 // not woken
+#define WAKE_GRANTABLE 1 // picked by the batch of a release, confirmed with fits_plan
+#define WAKE_RECHECK 2 // the process can finish, the request has to be checked again
+
 typedef struct {
     int N; // number of processes
     int M; // number of resource types
@@ -20,179 +27,734 @@ typedef struct {
     int** need; // the resource need of each process at an instance
 } Banker;
 
+typedef struct {
+    int* waiting; // 1 for the processes blocked inside ralloc_request, 0 otherwise
+    int* work; // Available + Allocation of the processes that are not waiting
+    int* scratch; // work vector reused by each detection pass
+    int* finish; // finish vector reused by each detection pass
+    int* deadlocked; // procarray computed by the latest detection pass
+    int num_deadlocked; // number of deadlocked processes found by the latest pass
+    int dirty; // 1 if a process started waiting after the latest pass
+    ralloc_handler handler; // invoked with the deadlocked set as soon as it forms
+    int recovery; // victim selection method, RECOVERY_NONE disables recovery
+    int* priority; // user supplied priority of each process, lower ones are aborted first
+    long* start; // logical time at which each process started holding resources
+    long clock; // logical clock advanced by each request made while holding nothing
+    int* aborted; // 1 if the pending request of the process must return RALLOC_ABORTED
+    int num_waiting; // number of requests waiting on cond, written with every shard held
+    int*** alternatives; // demands of each waiting ralloc_request_any, NULL otherwise
+    int* num_alternatives; // number of demands in alternatives, 1 for ralloc_request
+} Detector;
+
+typedef struct pending {
+    int pid; // id of the waiting process
+    int* demand; // the request that could not be granted safely
+    int wake; // WAKE_NONE, WAKE_GRANTABLE or WAKE_RECHECK, set by wake_pending
+    pthread_cond_t cond; // private condition, signaled by wake_pending
+    struct pending* next;
+} Pending;
+
+typedef struct {
+    int* waiting; // 1 for the processes with a pending request
+    int* position; // position of each process in the safe sequence
+    int** slack; // Work - Need at each position of the safe sequence
+    int* work; // work vector of the safe sequence computation
+    int* finish; // finish vector of the safe sequence computation
+    int valid; // position and slack describe a safe sequence of the current state
+    int enabled; // set by ralloc_ctx_batching
+} Batch;
+
+typedef struct {
+    pthread_mutex_t lock; // protects the column of the resource type in the Banker
+    pthread_cond_t cond; // DEADLOCK_NOTHING requests waiting for the resource type
+} Shard;
+
+struct ralloc_ctx {
+    Banker banker;
+    Detector detector;
+    int policy;
+    pthread_mutex_t lock; // mutex lock to implement monitor functionality
+    pthread_cond_t cond; // condition variable to implement waiting queues
+    int* system_max; // maximum resources of the system
+    // Per resource type locks of DEADLOCK_NOTHING and DEADLOCK_DETECTION, the global
+    // lock is acquired before them and they are acquired in increasing type order
+    Shard* shards;
+    ralloc_stats stats; // cumulative counters, updated atomically
+    // Seqlock counter of each resource type, odd while its column of available,
+    // allocation or need is written, so that snapshots never take a lock
+    unsigned* version;
+    // DEADLOCK_AVOIDANCE requests waiting with batching enabled, in FIFO order
+    Pending* pending_head;
+    Pending* pending_tail;
+    Batch batch; // safe sequence kept for the waiting requests, see wait_pending
+    int* sequence; // last safe sequence found, tried first by is_safe_avoidance
+    int groups[MAX_RESOURCE_GROUPS][MAX_RESOURCE_TYPES]; // resource types of each group
+    int group_sizes[MAX_RESOURCE_GROUPS]; // 0 for undefined groups
+    // Calls are appended to trace while it is not NULL, see ralloc_ctx_trace
+    FILE* trace;
+    long trace_start;
+    pthread_mutex_t trace_lock;
+};
+
 // Global Variables
-Banker banker;
-int policy;
-pthread_mutex_t lock; // mutex lock to implement monitor functionality
-pthread_cond_t cond; // condition variable to implement waiting queues
-int* system_max; // maximum resources of the system
+ralloc_ctx* default_ctx; // context used by the functions without a context argument
 
 // Helper Functions
-void set_need(int pid);
+void set_need(ralloc_ctx* ctx, int pid);
 int allocate_vector(int* vec[], int to_set[], int size);
 int allocate_matrix(int** matrix[], int* to_set[], int num_rows, int num_cols);
-int can_allocate(int request[], int available[]);
-int validate_pid(int pid);
+int can_allocate(ralloc_ctx* ctx, int request[], int available[]);
+int validate_pid(ralloc_ctx* ctx, int pid);
 void update_vector(int* vec[], int to_add[], int size, int op);
-void update_state(int pid, int to_handle[], int op);
-int is_safe(int work[], int* need[], int* allocation[]);
-int is_safe_avoidance(int pid, int demand[]);
-int is_safe_detection(int procarray[]);
+void update_state(ralloc_ctx* ctx, int pid, int to_handle[], int op);
+int is_safe(ralloc_ctx* ctx, int work[], int* need[], int* allocation[], int order[]);
+int follows_sequence(ralloc_ctx* ctx, int pid, int demand[]);
+void update_plan(ralloc_ctx* ctx, int pid, int demand[], int op);
+int fits_plan(ralloc_ctx* ctx, int pid, int demand[]);
+int is_safe_avoidance(ralloc_ctx* ctx, int pid, int demand[]);
+void start_waiting(ralloc_ctx* ctx, int pid);
+void stop_waiting(ralloc_ctx* ctx, int pid);
+int detect_deadlock(ralloc_ctx* ctx);
+int select_victim(ralloc_ctx* ctx);
+void abort_process(ralloc_ctx* ctx, int pid);
+int recover_deadlock(ralloc_ctx* ctx);
+void lock_shards(ralloc_ctx* ctx, int demand[]);
+void unlock_shards(ralloc_ctx* ctx, int demand[]);
+int find_short_type(ralloc_ctx* ctx, int demand[]);
+void update_columns(ralloc_ctx* ctx, int pid, int to_handle[], int op);
+int request_sharded(ralloc_ctx* ctx, int pid, int demand[]);
+int request_blocking(ralloc_ctx* ctx, int pid, int* demands[], int num_alternatives);
+int first_fit(ralloc_ctx* ctx, int* demands[], int num_alternatives);
+int can_finish(ralloc_ctx* ctx, int pid, int work[]);
+int sequence_slack(ralloc_ctx* ctx);
+int choose_alternative(ralloc_ctx* ctx, int pid, int* demands[], int num_alternatives);
+int request_any_sharded(ralloc_ctx* ctx, int pid, int* demands[], int num_alternatives);
+int release_sharded(ralloc_ctx* ctx, int pid, int demand[]);
 void free_matrix(int* matrix[], int num_rows);
+void free_state(ralloc_ctx* ctx);
+long now_ns();
+void add_stat(long* counter, long amount);
+void record_wait(ralloc_ctx* ctx, long wait_start);
+void begin_write(ralloc_ctx* ctx, int columns[]);
+void end_write(ralloc_ctx* ctx, int columns[]);
+void trace_call(ralloc_ctx* ctx, int op, int pid, int vector[]);
+void trace_calls(ralloc_ctx* ctx, int op, int pid, int* vectors[], int num_vectors);
+void trace_value(ralloc_ctx* ctx, int op, int pid, int value);
+void mark_start(ralloc_ctx* ctx, int pid);
+int safe_sequence(ralloc_ctx* ctx);
+int wait_pending(ralloc_ctx* ctx, int pid, int demand[]);
+void wake_pending(ralloc_ctx* ctx);
+void pick_pending(ralloc_ctx* ctx);
+void remove_pending(ralloc_ctx* ctx, Pending* entry);
 
 // Debugging Functions
 void print_vector(int size, int vector[]);
 void print_matrix(int num_rows, int num_cols, int* matrix[]);
-void print_curr_state();
+void print_curr_state(ralloc_ctx* ctx);
     
-int ralloc_init(int p_count, int r_count, int r_exist[], int d_handling) {
-    banker.N = p_count;
-    banker.M = r_count;
-    policy = d_handling;
-    if (!allocate_vector(&system_max, r_exist, banker.M)) {
+ralloc_ctx* ralloc_ctx_init(int p_count, int r_count, int r_exist[], int d_handling) {
+    ralloc_ctx* ctx = calloc(1, sizeof(ralloc_ctx)); // unallocated members stay NULL
+    if (ctx == NULL) {
+        printf("Error: Cannot alocate space for the context.\n");
+        return NULL;
+    }
+    ctx->banker.N = p_count;
+    ctx->banker.M = r_count;
+    ctx->policy = d_handling;
+    if (!allocate_vector(&ctx->system_max, r_exist, ctx->banker.M)) {
         printf("Error: Cannot alocate space for the system_max vector.\n");
-        return -1;
+        free_state(ctx);
+        return NULL;
     }
-    if (!allocate_vector(&banker.available, r_exist, banker.M)) {
+    if (!allocate_vector(&ctx->banker.available, r_exist, ctx->banker.M)) {
         printf("Error: Cannot alocate space for the available vector.\n");
-        return -1;
+        free_state(ctx);
+        return NULL;
     }
-    if (!allocate_matrix(&banker.allocation, NULL, banker.N, banker.M)) {
+    if (!allocate_matrix(&ctx->banker.allocation, NULL, ctx->banker.N, ctx->banker.M)) {
         printf("Error: Cannot alocate space for the allocation matrix.\n");
-        return -1;
+        free_state(ctx);
+        return NULL;
     }
-    if (policy == DEADLOCK_AVOIDANCE || policy == DEADLOCK_DETECTION) {
-        if (!allocate_matrix(&banker.need, NULL, banker.N, banker.M)) {
+    if ((ctx->version = calloc(ctx->banker.M, sizeof(unsigned))) == NULL) {
+        printf("Error: Cannot alocate space for the version vector.\n");
+        free_state(ctx);
+        return NULL;
+    }
+    if (ctx->policy == DEADLOCK_AVOIDANCE || ctx->policy == DEADLOCK_DETECTION) {
+        if (!allocate_matrix(&ctx->banker.need, NULL, ctx->banker.N, ctx->banker.M)) {
             printf("Error: Cannot alocate space for the need matrix.\n");
-            return -1;
+            free_state(ctx);
+            return NULL;
         }
-    } else {
-        banker.need = NULL;
     }
-    if (policy == DEADLOCK_AVOIDANCE) {
-        if (!allocate_matrix(&banker.max_demand, NULL, banker.N, banker.M)) {
+    if (ctx->policy == DEADLOCK_DETECTION) {
+        if (!allocate_vector(&ctx->detector.waiting, NULL, ctx->banker.N)
+            || !allocate_vector(&ctx->detector.work, r_exist, ctx->banker.M)
+            || !allocate_vector(&ctx->detector.scratch, NULL, ctx->banker.M)
+            || !allocate_vector(&ctx->detector.finish, NULL, ctx->banker.N)
+            || !allocate_vector(&ctx->detector.deadlocked, NULL, ctx->banker.N)
+            || !allocate_vector(&ctx->detector.priority, NULL, ctx->banker.N)
+            || !allocate_vector(&ctx->detector.aborted, NULL, ctx->banker.N)
+            || !allocate_vector(&ctx->detector.num_alternatives, NULL, ctx->banker.N)
+            || (ctx->detector.alternatives = calloc(ctx->banker.N, sizeof(int**))) == NULL
+            || (ctx->detector.start = calloc(ctx->banker.N, sizeof(long))) == NULL) {
+            printf("Error: Cannot alocate space for the detection vectors.\n");
+            free_state(ctx);
+            return NULL;
+        }
+        ctx->detector.dirty = 1;
+        ctx->detector.recovery = RECOVERY_NONE;
+    }
+    if (ctx->policy == DEADLOCK_AVOIDANCE) {
+        if (!allocate_matrix(&ctx->banker.max_demand, NULL, ctx->banker.N, ctx->banker.M)) {
             printf("Error: Cannot alocate space for the max_demand matrix.\n");
-            return -1;
+            free_state(ctx);
+            return NULL;
+        }
+        if (!allocate_vector(&ctx->batch.waiting, NULL, ctx->banker.N)
+            || !allocate_vector(&ctx->batch.position, NULL, ctx->banker.N)
+            || !allocate_matrix(&ctx->batch.slack, NULL, ctx->banker.N, ctx->banker.M)
+            || !allocate_vector(&ctx->batch.work, NULL, ctx->banker.M)
+            || !allocate_vector(&ctx->batch.finish, NULL, ctx->banker.N)) {
+            printf("Error: Cannot alocate space for the batch vectors.\n");
+            free_state(ctx);
+            return NULL;
+        }
+        if (!allocate_vector(&ctx->sequence, NULL, ctx->banker.N)) {
+            printf("Error: Cannot alocate space for the sequence vector.\n");
+            free_state(ctx);
+            return NULL;
+        }
+        for (int i = 0; i < ctx->banker.N; i++) {
+            ctx->sequence[i] = i; // any order is a valid guess
         }
-    } else {
-        banker.max_demand = NULL;
     }
-    if (pthread_mutex_init(&lock, NULL) != 0) {
+    if (ctx->policy == DEADLOCK_NOTHING || ctx->policy == DEADLOCK_DETECTION) {
+        if ((ctx->shards = malloc(ctx->banker.M * sizeof(Shard))) == NULL) {
+            printf("Error: Cannot alocate space for the resource type locks.\n");
+            free_state(ctx);
+            return NULL;
+        }
+        for (int i = 0; i < ctx->banker.M; i++) {
+            if (pthread_mutex_init(&ctx->shards[i].lock, NULL) != 0
+                || pthread_cond_init(&ctx->shards[i].cond, NULL) != 0) {
+                printf("Error: Resource type lock initialization failed.\n");
+                free_state(ctx);
+                return NULL;
+            }
+        }
+    }
+    if (pthread_mutex_init(&ctx->lock, NULL) != 0) {
         printf("Error: Mutex lock initialization failed.\n");
-        return -1;
+        free_state(ctx);
+        return NULL;
     }
-    if (pthread_cond_init(&cond, NULL) != 0) {
+    if (pthread_cond_init(&ctx->cond, NULL) != 0) {
         printf("Error: Condition variable initialization failed.\n");
-        return -1;
+        free_state(ctx);
+        return NULL;
     }
-    return 0;
+    if (pthread_mutex_init(&ctx->trace_lock, NULL) != 0) {
+        printf("Error: Mutex lock initialization failed.\n");
+        free_state(ctx);
+        return NULL;
+    }
+    return ctx;
 }
 
-int ralloc_maxdemand(int pid, int r_max[]){
-    pthread_mutex_lock(&lock);
-    if (!validate_pid(pid)) {
-        pthread_mutex_unlock(&lock);
+int ralloc_ctx_maxdemand(ralloc_ctx* ctx, int pid, int r_max[]){
+    trace_call(ctx, RALLOC_TRACE_MAXDEMAND, pid, r_max);
+    pthread_mutex_lock(&ctx->lock);
+    if (!validate_pid(ctx, pid)) {
+        pthread_mutex_unlock(&ctx->lock);
         return -1;
     }
-    if (!can_allocate(r_max, system_max)) {
+    if (!can_allocate(ctx, r_max, ctx->system_max)) {
         printf("Error: Maximum demand of process %d exceeds maximum system resources.\n", pid);
-        pthread_mutex_unlock(&lock);
+        pthread_mutex_unlock(&ctx->lock);
         return -1;
     }
-    if (policy == DEADLOCK_AVOIDANCE) {
+    if (ctx->policy == DEADLOCK_AVOIDANCE) {
         int i;
-        for (i = 0; i < banker.M; i++) {
-            banker.max_demand[pid][i] = r_max[i];
+        begin_write(ctx, NULL);
+        for (i = 0; i < ctx->banker.M; i++) {
+            ctx->banker.max_demand[pid][i] = r_max[i];
             // Initially (Allocated) = [0 ... 0]: Need = Max - Allocated = Max
-            banker.need[pid][i] = r_max[i];
+            ctx->banker.need[pid][i] = r_max[i];
         }
+        end_write(ctx, NULL);
+        ctx->batch.valid = 0; // the need of the process changed in another way
     }
-    pthread_mutex_unlock(&lock);
+    pthread_mutex_unlock(&ctx->lock);
     return 0;
 }
 
-int ralloc_request(int pid, int demand[]) {
-    pthread_mutex_lock(&lock);
-    if (!validate_pid(pid)) {
-        pthread_mutex_unlock(&lock);
+int ralloc_ctx_request(ralloc_ctx* ctx, int pid, int demand[]) {
+    trace_call(ctx, RALLOC_TRACE_REQUEST, pid, demand);
+    if (ctx->policy != DEADLOCK_AVOIDANCE) {
+        return request_sharded(ctx, pid, demand);
+    }
+    pthread_mutex_lock(&ctx->lock);
+    if (!validate_pid(ctx, pid)) {
+        pthread_mutex_unlock(&ctx->lock);
         return -1;
     }
-    if (!can_allocate(demand, system_max)) {
+    if (!can_allocate(ctx, demand, ctx->system_max)) {
         printf("Error: The request exceeds maximum system resources.\n");
-        pthread_mutex_unlock(&lock);
+        pthread_mutex_unlock(&ctx->lock);
+        return -1;
+    }
+    int safe = is_safe_avoidance(ctx, pid, demand);
+    if (safe == -1) { // error occured in the call
+        pthread_mutex_unlock(&ctx->lock);
         return -1;
     }
-    if (policy == DEADLOCK_DETECTION) {
-        for (int i = 0; i < banker.M; i++) {
-            banker.need[pid][i] = demand[i]; // record the request as pending
+    if (!safe) {
+        long wait_start = now_ns();
+        if (ctx->batch.enabled) {
+            safe = wait_pending(ctx, pid, demand);
+        } else {
+            do {
+                pthread_cond_wait(&ctx->cond, &ctx->lock);
+                safe = is_safe_avoidance(ctx, pid, demand);
+            } while (safe == 0);
+        }
+        record_wait(ctx, wait_start);
+        if (safe == -1) { // error occured in the call
+            pthread_mutex_unlock(&ctx->lock);
+            return -1;
         }
     }
-    if (policy == DEADLOCK_NOTHING || policy == DEADLOCK_DETECTION) {
-        while (!can_allocate(demand, banker.available)) {
-            pthread_cond_wait(&cond, &lock); // cannot allocate resources the request must wait
+    update_state(ctx, pid, demand, -1);
+    trace_call(ctx, RALLOC_TRACE_GRANT, pid, demand);
+    add_stat(&ctx->stats.grants, 1);
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+int ralloc_ctx_try_request(ralloc_ctx* ctx, int pid, int demand[]) {
+    trace_call(ctx, RALLOC_TRACE_TRY_REQUEST, pid, demand);
+    if (!validate_pid(ctx, pid)) {
+        return -1;
+    }
+    if (!can_allocate(ctx, demand, ctx->system_max)) {
+        printf("Error: The request exceeds maximum system resources.\n");
+        return -1;
+    }
+    int granted;
+    if (ctx->policy == DEADLOCK_AVOIDANCE) {
+        pthread_mutex_lock(&ctx->lock);
+        granted = is_safe_avoidance(ctx, pid, demand);
+        if (granted == 1) {
+            update_state(ctx, pid, demand, -1);
         }
-        update_state(pid, demand, -1);
-    } else if (policy == DEADLOCK_AVOIDANCE) {
-        int safe;
-        while ((safe = is_safe_avoidance(pid, demand)) != 1) {
-            if (safe == -1) { // error occured in the call
-                pthread_mutex_unlock(&lock);
-                return -1;
+        pthread_mutex_unlock(&ctx->lock);
+        if (granted == -1) { // error occured in the call
+            return -1;
+        }
+    } else {
+        if (ctx->policy == DEADLOCK_DETECTION) {
+            mark_start(ctx, pid);
+        }
+        lock_shards(ctx, demand);
+        granted = (find_short_type(ctx, demand) == -1);
+        if (granted) {
+            update_columns(ctx, pid, demand, -1);
+        }
+        unlock_shards(ctx, demand);
+    }
+    if (!granted) {
+        return RALLOC_WOULDBLOCK;
+    }
+    add_stat(&ctx->stats.grants, 1);
+    return 0;
+}
+
+int ralloc_ctx_request_any(ralloc_ctx* ctx, int pid, int* demands[], int num_alternatives) {
+    if (!validate_pid(ctx, pid)) {
+        return -1;
+    }
+    if (num_alternatives < 1) {
+        printf("Error: The request has no alternatives.\n");
+        return -1;
+    }
+    trace_calls(ctx, RALLOC_TRACE_REQUEST_ANY, pid, demands, num_alternatives);
+    for (int a = 0; a < num_alternatives; a++) {
+        if (!can_allocate(ctx, demands[a], ctx->system_max)) {
+            printf("Error: The request exceeds maximum system resources.\n");
+            return -1;
+        }
+    }
+    int choice;
+    if (ctx->policy != DEADLOCK_AVOIDANCE) {
+        choice = request_any_sharded(ctx, pid, demands, num_alternatives);
+    } else {
+        pthread_mutex_lock(&ctx->lock);
+        long wait_start = 0;
+        while ((choice = choose_alternative(ctx, pid, demands, num_alternatives)) == -1) {
+            if (wait_start == 0) {
+                wait_start = now_ns();
             }
-            pthread_cond_wait(&cond, &lock);
+            pthread_cond_wait(&ctx->cond, &ctx->lock); // every release broadcasts cond
+        }
+        if (wait_start != 0) {
+            record_wait(ctx, wait_start);
+        }
+        if (choice >= 0) {
+            update_state(ctx, pid, demands[choice], -1);
+            trace_call(ctx, RALLOC_TRACE_GRANT, pid, demands[choice]);
+            add_stat(&ctx->stats.grants, 1);
+        } else { // error occured in the call
+            choice = -1;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    return choice;
+}
+
+int ralloc_ctx_group(ralloc_ctx* ctx, int group, int types[], int num_types) {
+    if (group < 0 || group >= MAX_RESOURCE_GROUPS) {
+        printf("Error: Invalid resource group.\n");
+        return -1;
+    }
+    if (num_types < 0 || num_types > ctx->banker.M || num_types > MAX_RESOURCE_TYPES) {
+        printf("Error: Invalid number of resource types in the group.\n");
+        return -1;
+    }
+    for (int i = 0; i < num_types; i++) {
+        if (types[i] < 0 || types[i] >= ctx->banker.M) {
+            printf("Error: Invalid resource type in the group.\n");
+            return -1;
         }
-        update_state(pid, demand, -1);
     }
-    pthread_mutex_unlock(&lock);
+    pthread_mutex_lock(&ctx->lock);
+    for (int i = 0; i < num_types; i++) {
+        ctx->groups[group][i] = types[i];
+    }
+    ctx->group_sizes[group] = num_types;
+    pthread_mutex_unlock(&ctx->lock);
     return 0;
 }
 
-int ralloc_release(int pid, int demand[]) {
-    pthread_mutex_lock(&lock);
-    if (!can_allocate(demand, banker.allocation[pid])) {
+int ralloc_ctx_request_group(ralloc_ctx* ctx, int pid, int group, int amount) {
+    if (group < 0 || group >= MAX_RESOURCE_GROUPS || amount < 1) {
+        printf("Error: Invalid group request.\n");
+        return -1;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    int num_types = ctx->group_sizes[group];
+    int types[MAX_RESOURCE_TYPES];
+    for (int i = 0; i < num_types; i++) {
+        types[i] = ctx->groups[group][i];
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    if (num_types == 0) {
+        printf("Error: Resource group %d is empty.\n", group);
+        return -1;
+    }
+    // One alternative per resource type of the group, in the order of the group
+    int vectors[num_types][ctx->banker.M];
+    int* demands[num_types];
+    for (int a = 0; a < num_types; a++) {
+        for (int i = 0; i < ctx->banker.M; i++) {
+            vectors[a][i] = (i == types[a]) ? amount : 0;
+        }
+        demands[a] = vectors[a];
+    }
+    int choice = ralloc_ctx_request_any(ctx, pid, demands, num_types);
+    return (choice >= 0) ? types[choice] : choice;
+}
+
+int ralloc_ctx_release(ralloc_ctx* ctx, int pid, int demand[]) {
+    trace_call(ctx, RALLOC_TRACE_RELEASE, pid, demand);
+    if (ctx->policy != DEADLOCK_AVOIDANCE) {
+        return release_sharded(ctx, pid, demand);
+    }
+    pthread_mutex_lock(&ctx->lock);
+    if (!can_allocate(ctx, demand, ctx->banker.allocation[pid])) {
         printf("Error: Process %d tries to release more resources than it owns.\n", pid);
-        pthread_mutex_unlock(&lock);
+        pthread_mutex_unlock(&ctx->lock);
         return -1;
     }
-    update_state(pid, demand, 1);
-    pthread_cond_broadcast(&cond);
-    pthread_mutex_unlock(&lock);
+    update_state(ctx, pid, demand, 1);
+    pthread_cond_broadcast(&ctx->cond);
+    wake_pending(ctx);
+    pthread_mutex_unlock(&ctx->lock);
     return 0;
 }
 
-int ralloc_detection(int procarray[]) {
-    pthread_mutex_lock(&lock);
-    if (policy != DEADLOCK_DETECTION) {
+int ralloc_ctx_detection(ralloc_ctx* ctx, int procarray[]) {
+    trace_call(ctx, RALLOC_TRACE_DETECTION, -1, NULL);
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->policy != DEADLOCK_DETECTION) {
         printf("Error: Invalid policy.\n");
+        pthread_mutex_unlock(&ctx->lock);
         return -1;
     }
-    int num_deadlocked = is_safe_detection(procarray);
-    pthread_mutex_unlock(&lock);
+    lock_shards(ctx, NULL);
+    int num_deadlocked = detect_deadlock(ctx);
+    for (int i = 0; i < ctx->banker.N; i++) {
+        procarray[i] = ctx->detector.deadlocked[i];
+    }
+    if (num_deadlocked > 0 && ctx->detector.recovery != RECOVERY_NONE) {
+        recover_deadlock(ctx);
+    }
+    unlock_shards(ctx, NULL);
+    pthread_mutex_unlock(&ctx->lock);
     return num_deadlocked;
 }
 
-int ralloc_end() {
-    free(banker.available);
-    if (policy == DEADLOCK_AVOIDANCE) {
-        free_matrix(banker.max_demand, banker.N);
+int ralloc_ctx_detection_handler(ralloc_ctx* ctx, ralloc_handler handler) {
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->policy != DEADLOCK_DETECTION) {
+        printf("Error: Invalid policy.\n");
+        pthread_mutex_unlock(&ctx->lock);
+        return -1;
+    }
+    ctx->detector.handler = handler;
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+int ralloc_ctx_recovery(ralloc_ctx* ctx, int method) {
+    trace_value(ctx, RALLOC_TRACE_RECOVERY, -1, method);
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->policy != DEADLOCK_DETECTION) {
+        printf("Error: Invalid policy.\n");
+        pthread_mutex_unlock(&ctx->lock);
+        return -1;
+    }
+    if (method < RECOVERY_NONE || method > RECOVERY_PRIORITY) {
+        printf("Error: Invalid recovery method.\n");
+        pthread_mutex_unlock(&ctx->lock);
+        return -1;
+    }
+    ctx->detector.recovery = method;
+    if (method != RECOVERY_NONE) {
+        lock_shards(ctx, NULL);
+        recover_deadlock(ctx); // resolve the deadlocks that formed before
+        unlock_shards(ctx, NULL);
     }
-    free_matrix(banker.allocation, banker.N);
-    if (policy == DEADLOCK_AVOIDANCE || policy == DEADLOCK_DETECTION) {
-        free_matrix(banker.need, banker.N);
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+int ralloc_ctx_batching(ralloc_ctx* ctx, int enabled) {
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->policy != DEADLOCK_AVOIDANCE) {
+        printf("Error: Invalid policy.\n");
+        pthread_mutex_unlock(&ctx->lock);
+        return -1;
     }
-    free(system_max);
-    pthread_mutex_destroy(&lock);
-    pthread_cond_destroy(&cond);
+    ctx->batch.enabled = (enabled != 0);
+    pthread_mutex_unlock(&ctx->lock);
     return 0;
 }
 
+int ralloc_ctx_priority(ralloc_ctx* ctx, int pid, int priority) {
+    trace_value(ctx, RALLOC_TRACE_PRIORITY, pid, priority);
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->policy != DEADLOCK_DETECTION) {
+        printf("Error: Invalid policy.\n");
+        pthread_mutex_unlock(&ctx->lock);
+        return -1;
+    }
+    if (!validate_pid(ctx, pid)) {
+        pthread_mutex_unlock(&ctx->lock);
+        return -1;
+    }
+    ctx->detector.priority[pid] = priority;
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+int ralloc_ctx_stats(ralloc_ctx* ctx, ralloc_stats* stats) {
+    stats->safety_checks = __atomic_load_n(&ctx->stats.safety_checks, __ATOMIC_RELAXED);
+    stats->safety_ns = __atomic_load_n(&ctx->stats.safety_ns, __ATOMIC_RELAXED);
+    stats->waits = __atomic_load_n(&ctx->stats.waits, __ATOMIC_RELAXED);
+    stats->wait_ns = __atomic_load_n(&ctx->stats.wait_ns, __ATOMIC_RELAXED);
+    stats->grants = __atomic_load_n(&ctx->stats.grants, __ATOMIC_RELAXED);
+    stats->unsafe_rejections = __atomic_load_n(&ctx->stats.unsafe_rejections, __ATOMIC_RELAXED);
+    stats->detections = __atomic_load_n(&ctx->stats.detections, __ATOMIC_RELAXED);
+    stats->fast_path_hits = __atomic_load_n(&ctx->stats.fast_path_hits, __ATOMIC_RELAXED);
+    stats->fast_path_misses = __atomic_load_n(&ctx->stats.fast_path_misses, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int ralloc_ctx_snapshot(ralloc_ctx* ctx, int available[], int allocation[], int need[],
+                        ralloc_stats* stats) {
+    int N = ctx->banker.N;
+    int M = ctx->banker.M;
+    unsigned start[M];
+    int stable;
+    do { // retry until no column was written during the copy
+        stable = 1;
+        for (int j = 0; j < M; j++) {
+            start[j] = __atomic_load_n(&ctx->version[j], __ATOMIC_ACQUIRE);
+            stable &= !(start[j] & 1);
+        }
+        if (!stable) {
+            continue;
+        }
+        for (int j = 0; j < M; j++) {
+            if (available != NULL) {
+                available[j] = __atomic_load_n(&ctx->banker.available[j], __ATOMIC_RELAXED);
+            }
+            for (int i = 0; i < N; i++) {
+                if (allocation != NULL) {
+                    allocation[i * M + j] = __atomic_load_n(&ctx->banker.allocation[i][j], __ATOMIC_RELAXED);
+                }
+                if (need != NULL) {
+                    need[i * M + j] = (ctx->banker.need == NULL) ? 0
+                        : __atomic_load_n(&ctx->banker.need[i][j], __ATOMIC_RELAXED);
+                }
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        for (int j = 0; j < M; j++) {
+            stable &= (__atomic_load_n(&ctx->version[j], __ATOMIC_RELAXED) == start[j]);
+        }
+    } while (!stable);
+    if (stats != NULL) {
+        ralloc_ctx_stats(ctx, stats);
+    }
+    return 0;
+}
+
+int ralloc_ctx_trace(ralloc_ctx* ctx, const char* path) {
+    if (path != NULL && ctx->banker.M > MAX_RESOURCE_TYPES) {
+        printf("Error: Too many resource types to trace.\n");
+        return -1;
+    }
+    FILE* trace = NULL;
+    if (path != NULL) {
+        if ((trace = fopen(path, "wb")) == NULL) {
+            printf("Error: Cannot open the trace file %s.\n", path);
+            return -1;
+        }
+        ralloc_trace_header header = {RALLOC_TRACE_MAGIC, ctx->banker.N, ctx->banker.M, ctx->policy, {0}};
+        for (int i = 0; i < ctx->banker.M; i++) {
+            header.r_exist[i] = ctx->system_max[i];
+        }
+        fwrite(&header, sizeof(header), 1, trace);
+    }
+    pthread_mutex_lock(&ctx->trace_lock);
+    FILE* previous = ctx->trace;
+    ctx->trace_start = now_ns();
+    __atomic_store_n(&ctx->trace, trace, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx->trace_lock);
+    if (previous != NULL) {
+        fclose(previous);
+    }
+    if (trace != NULL && ctx->policy == DEADLOCK_DETECTION) { // the settings made before the trace
+        pthread_mutex_lock(&ctx->lock);
+        trace_value(ctx, RALLOC_TRACE_RECOVERY, -1, ctx->detector.recovery);
+        for (int i = 0; i < ctx->banker.N; i++) {
+            if (ctx->detector.priority[i] != 0) {
+                trace_value(ctx, RALLOC_TRACE_PRIORITY, i, ctx->detector.priority[i]);
+            }
+        }
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    return 0;
+}
+
+int ralloc_ctx_end(ralloc_ctx* ctx) {
+    ralloc_ctx_trace(ctx, NULL); // flush the trace
+    if (ctx->shards != NULL) {
+        for (int i = 0; i < ctx->banker.M; i++) {
+            pthread_mutex_destroy(&ctx->shards[i].lock);
+            pthread_cond_destroy(&ctx->shards[i].cond);
+        }
+    }
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->trace_lock);
+    free_state(ctx);
+    return 0;
+}
+
+// The original interface, operates on a single process wide context
+
+int ralloc_init(int p_count, int r_count, int r_exist[], int d_handling) {
+    default_ctx = ralloc_ctx_init(p_count, r_count, r_exist, d_handling);
+    return (default_ctx == NULL) ? -1 : 0;
+}
+
+int ralloc_maxdemand(int pid, int r_max[]) {
+    return ralloc_ctx_maxdemand(default_ctx, pid, r_max);
+}
+
+int ralloc_try_request(int pid, int demand[]) {
+    return ralloc_ctx_try_request(default_ctx, pid, demand);
+}
+
+int ralloc_request_any(int pid, int* demands[], int num_alternatives) {
+    return ralloc_ctx_request_any(default_ctx, pid, demands, num_alternatives);
+}
+
+int ralloc_group(int group, int types[], int num_types) {
+    return ralloc_ctx_group(default_ctx, group, types, num_types);
+}
+
+int ralloc_request_group(int pid, int group, int amount) {
+    return ralloc_ctx_request_group(default_ctx, pid, group, amount);
+}
+
+int ralloc_request(int pid, int demand[]) {
+    return ralloc_ctx_request(default_ctx, pid, demand);
+}
+
+int ralloc_release(int pid, int demand[]) {
+    return ralloc_ctx_release(default_ctx, pid, demand);
+}
+
+int ralloc_detection(int procarray[]) {
+    return ralloc_ctx_detection(default_ctx, procarray);
+}
+
+int ralloc_detection_handler(ralloc_handler handler) {
+    return ralloc_ctx_detection_handler(default_ctx, handler);
+}
+
+int ralloc_recovery(int method) {
+    return ralloc_ctx_recovery(default_ctx, method);
+}
+
+int ralloc_batching(int enabled) {
+    return ralloc_ctx_batching(default_ctx, enabled);
+}
+
+int ralloc_priority(int pid, int priority) {
+    return ralloc_ctx_priority(default_ctx, pid, priority);
+}
+
+int ralloc_stats_get(ralloc_stats* stats) {
+    return ralloc_ctx_stats(default_ctx, stats);
+}
+
+int ralloc_snapshot(int available[], int allocation[], int need[], ralloc_stats* stats) {
+    return ralloc_ctx_snapshot(default_ctx, available, allocation, need, stats);
+}
+
+int ralloc_trace(const char* path) {
+    return ralloc_ctx_trace(default_ctx, path);
+}
+
+int ralloc_end() {
+    int result = ralloc_ctx_end(default_ctx);
+    default_ctx = NULL;
+    return result;
+}
+
 /**
  * Computes the and sets the need matrix according to the rule:
  * Need = Max Demand - Allocation
  */
-void set_need(int pid) {
-    for (int i = 0; i < banker.M; i++) {
-        banker.need[pid][i] = banker.max_demand[pid][i] - banker.allocation[pid][i];
+void set_need(ralloc_ctx* ctx, int pid) {
+    for (int i = 0; i < ctx->banker.M; i++) {
+        ctx->banker.need[pid][i] = ctx->banker.max_demand[pid][i] - ctx->banker.allocation[pid][i];
     }
 }
 
@@ -230,7 +792,7 @@ int allocate_vector(int* vec[], int to_set[], int size) {
  * @return 1 on success, 0 on failure
  */
 int allocate_matrix(int** matrix[], int* to_set[], int num_rows, int num_cols) {
-    if ((*matrix = malloc(num_rows * sizeof(int*))) == NULL) {
+    if ((*matrix = calloc(num_rows, sizeof(int*))) == NULL) {
         return 0;
     }
     for (int i = 0; i < num_rows; i++) {
@@ -255,8 +817,8 @@ int allocate_matrix(int** matrix[], int* to_set[], int num_rows, int num_cols) {
  * @param available Second vector in comparison
  * @return 1 if comparison evaluates true, 0 otherwise
  */
-int can_allocate(int request[], int available[]) {
-    for (int i = 0; i < banker.M; i++) {
+int can_allocate(ralloc_ctx* ctx, int request[], int available[]) {
+    for (int i = 0; i < ctx->banker.M; i++) {
         if (request[i] > available[i]) {
             return 0;
         }
@@ -270,8 +832,8 @@ int can_allocate(int request[], int available[]) {
  * @param pid Process id to be validated
  * @return 1 if the process id is valid, 0 otherwise
  */
-int validate_pid(int pid) {
-    if (pid < 0 || pid >= banker.N) {
+int validate_pid(ralloc_ctx* ctx, int pid) {
+    if (pid < 0 || pid >= ctx->banker.N) {
         printf("Error: The process id (pid) is invalid.\n");
         return 0;
     }
@@ -300,37 +862,92 @@ void update_vector(int* vec[], int to_add[], int size, int op) {
  * @param op Determines whether to allocate or release resources in the current
  *           state (-1 for allocation, 1 for release)
  */
-void update_state(int pid, int to_handle[], int op) {
-    update_vector(&banker.available, to_handle, banker.M, op);
-    update_vector(&banker.allocation[pid], to_handle, banker.M, -op);
-    if (policy == DEADLOCK_AVOIDANCE) {
-        set_need(pid);
-    } else if (policy == DEADLOCK_DETECTION) {
-        update_vector(&banker.need[pid], to_handle, banker.M, op);
+void update_state(ralloc_ctx* ctx, int pid, int to_handle[], int op) {
+    begin_write(ctx, NULL);
+    update_vector(&ctx->banker.available, to_handle, ctx->banker.M, op);
+    update_vector(&ctx->banker.allocation[pid], to_handle, ctx->banker.M, -op);
+    if (ctx->policy == DEADLOCK_AVOIDANCE) {
+        set_need(ctx, pid);
+    } else if (ctx->policy == DEADLOCK_DETECTION) {
+        update_vector(&ctx->banker.need[pid], to_handle, ctx->banker.M, op);
+    }
+    end_write(ctx, NULL);
+    if (ctx->policy == DEADLOCK_AVOIDANCE && ctx->batch.valid) {
+        update_plan(ctx, pid, to_handle, op);
+    }
+}
+
+/**
+ * Keeps the safe sequence of ctx->batch (see safe_sequence) up to date after
+ * the state changed. Releasing Demand from the process at position q raises
+ * the work vector of positions 0..q-1 by Demand, and at q both the work and the
+ * need grow by Demand, so the slack of positions before q grows by Demand and
+ * the sequence stays safe. Granting Demand lowers the same slacks, the sequence
+ * stays safe if Demand fitted in them (fits_plan) and is dropped otherwise.
+ * @param pid The id of the process whose allocation changed
+ * @param demand The amount allocated or released
+ * @param op -1 for allocation, 1 for release (as in update_state)
+ */
+void update_plan(ralloc_ctx* ctx, int pid, int demand[], int op) {
+    int position = ctx->batch.position[pid];
+    for (int k = 0; k < position; k++) {
+        for (int j = 0; j < ctx->banker.M; j++) {
+            ctx->batch.slack[k][j] += op * demand[j];
+            if (ctx->batch.slack[k][j] < 0) {
+                ctx->batch.valid = 0; // granted through another safe sequence
+                return;
+            }
+        }
     }
 }
 
+/**
+ * Checks whether granting a request keeps the safe sequence of ctx->batch safe:
+ * the request must fit in the available resources and in the slack of every
+ * position before the process.
+ * @param pid The id of the requesting process
+ * @param demand The request
+ * @return 1 if it fits, 0 otherwise
+ */
+int fits_plan(ralloc_ctx* ctx, int pid, int demand[]) {
+    if (!can_allocate(ctx, demand, ctx->banker.available)) {
+        return 0;
+    }
+    for (int k = 0; k < ctx->batch.position[pid]; k++) {
+        if (!can_allocate(ctx, demand, ctx->batch.slack[k])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /**
  * A method to check whether the current system state is safe (deadlock free) or not.
  * @param work The vector indicating the currently available system resources
  * @param need The matrix indicating the current need of each process
  * @param allocation The matrix indicating the current resource allocation of the processes
+ * @param order Receives the order in which the processes finish, can be NULL
  * @return 1 if the current state is safe, 0 otherwise and -1 in case of an error
  */
-int is_safe(int work[], int* need[], int* allocation[]) {
+int is_safe(ralloc_ctx* ctx, int work[], int* need[], int* allocation[], int order[]) {
     int* finish = NULL;
-    if (!allocate_vector(&finish, NULL, banker.N)) {
+    if (!allocate_vector(&finish, NULL, ctx->banker.N)) {
         printf("Error: Cannot alocate space for the finish vector.\n");
         return -1;
     }
-    for (int i = 0; i < banker.N; i++) {
-        if (can_allocate(need[i], work) && !finish[i]) {
-            update_vector(&work, allocation[i], banker.M, 1);
+    int num_finished = 0;
+    for (int i = 0; i < ctx->banker.N; i++) {
+        if (can_allocate(ctx, need[i], work) && !finish[i]) {
+            update_vector(&work, allocation[i], ctx->banker.M, 1);
             finish[i] = 1;
+            if (order != NULL) {
+                order[num_finished] = i;
+            }
+            num_finished++;
             i = -1;
         }
     }
-    for (int i = 0; i < banker.N; i++) {
+    for (int i = 0; i < ctx->banker.N; i++) {
         if (finish[i] == 0) { // process cannot finish
             free(finish);
             return 0;
@@ -340,115 +957,972 @@ int is_safe(int work[], int* need[], int* allocation[]) {
     return 1;
 }
 
+/**
+ * Checks whether the last safe sequence found is still a safe sequence once a
+ * request is granted. This takes a single pass over the processes and no
+ * copies, while is_safe searches for a sequence from scratch.
+ * @param pid The id of the requesting process
+ * @param demand The demand of the requesting process
+ * @return 1 if the sequence stays safe, 0 if it does not (the state may still be safe)
+ */
+int follows_sequence(ralloc_ctx* ctx, int pid, int demand[]) {
+    int work[ctx->banker.M]; // Work = Available - Demand
+    for (int j = 0; j < ctx->banker.M; j++) {
+        work[j] = ctx->banker.available[j] - demand[j];
+    }
+    for (int k = 0; k < ctx->banker.N; k++) {
+        int i = ctx->sequence[k];
+        int granted = (i == pid); // the request is added to the allocation of pid
+        for (int j = 0; j < ctx->banker.M; j++) {
+            if (ctx->banker.need[i][j] - granted * demand[j] > work[j]) {
+                return 0;
+            }
+        }
+        for (int j = 0; j < ctx->banker.M; j++) {
+            work[j] += ctx->banker.allocation[i][j] + granted * demand[j];
+        }
+    }
+    return 1;
+}
+
 /**
  * A method that calls is_safe to check whether the system state will be safe if a
- * request is allocated or not.
+ * request is allocated or not. The last safe sequence is tried first, is_safe is
+ * only called when the request breaks it.
  * @param pid The id of the requesting process
  * @param demand The demand of the requesting process
  * @return 1 if the future state is safe, 0 otherwise and -1 in case of an error
  */
-int is_safe_avoidance(int pid, int demand[]) {
-    if (!can_allocate(demand, banker.need[pid])) { // validate demand
+int is_safe_avoidance(ralloc_ctx* ctx, int pid, int demand[]) {
+    if (!can_allocate(ctx, demand, ctx->banker.need[pid])) { // validate demand
         printf("Error: Process requested more than the need it reported.\n");
         return -1;
     }
+    long check_start = now_ns();
+    if (follows_sequence(ctx, pid, demand)) {
+        add_stat(&ctx->stats.fast_path_hits, 1);
+        add_stat(&ctx->stats.safety_checks, 1);
+        add_stat(&ctx->stats.safety_ns, now_ns() - check_start);
+        return 1;
+    }
+    add_stat(&ctx->stats.fast_path_misses, 1);
     int* work = NULL; // Work = Available
-    if (!allocate_vector(&work, banker.available, banker.M)) {
+    if (!allocate_vector(&work, ctx->banker.available, ctx->banker.M)) {
         printf("Error: Cannot alocate space for the work vector.\n");
         return -1;
     }
-    update_vector(&work, demand, banker.M, -1); // Work = Work - Demand
+    update_vector(&work, demand, ctx->banker.M, -1); // Work = Work - Demand
     int** allocation = NULL;
-    if (!allocate_matrix(&allocation, banker.allocation, banker.N, banker.M)) {
+    if (!allocate_matrix(&allocation, ctx->banker.allocation, ctx->banker.N, ctx->banker.M)) {
         printf("Error: Cannot alocate space for the copied allocation matrix.\n");
         free(work);
         return -1;
     }
-    update_vector(&allocation[pid], demand, banker.M, 1); // Allocation = Allocation + Demand
+    update_vector(&allocation[pid], demand, ctx->banker.M, 1); // Allocation = Allocation + Demand
     int** need = NULL;
-    if (!allocate_matrix(&need, banker.need, banker.N, banker.M)) {
+    if (!allocate_matrix(&need, ctx->banker.need, ctx->banker.N, ctx->banker.M)) {
         printf("Error: Cannot alocate space for the copied need matrix.\n");
         free(work);
-        free_matrix(allocation, banker.N);
+        free_matrix(allocation, ctx->banker.N);
         return -1;
     }
-    update_vector(&need[pid], demand, banker.M, -1); // Need[pid] = Need[pid] - Demand
-    int safe = is_safe(work, need, allocation); // 1 for safe
+    update_vector(&need[pid], demand, ctx->banker.M, -1); // Need[pid] = Need[pid] - Demand
+    int order[ctx->banker.N];
+    int safe = is_safe(ctx, work, need, allocation, order); // 1 for safe
+    if (safe == 1) { // remember the sequence for the next requests
+        for (int i = 0; i < ctx->banker.N; i++) {
+            ctx->sequence[i] = order[i];
+        }
+    }
     free(work);
-    free_matrix(allocation, banker.N);
-    free_matrix(need, banker.N);
+    free_matrix(allocation, ctx->banker.N);
+    free_matrix(need, ctx->banker.N);
+    add_stat(&ctx->stats.safety_checks, 1);
+    add_stat(&ctx->stats.safety_ns, now_ns() - check_start);
+    if (safe == 0) {
+        add_stat(&ctx->stats.unsafe_rejections, 1);
+    }
     return safe;
 }
 
 /**
- * A method that calls check whether the current system state is safe, it computes
- * which processes are deadlocked if any and return the number of deadlocked processes.
- * @param procarray An array whose values are set the 1 for the running processes and
- *                  -1 for the deadlocked processes
- * @return num_deadlocked: Number of deadlocked processes, -1 in case of an error
+ * Marks a process as blocked on its pending request. Only the allocation of
+ * waiting processes is excluded from the detection work vector, so the vector
+ * changes exclusively when a process starts or stops waiting.
+ * @param pid The id of the process that is about to wait
  */
-int is_safe_detection(int procarray[]) {
-    int* work = NULL; // Work = Available
-    if (!allocate_vector(&work, banker.available, banker.M)) {
-        printf("Error: Cannot alocate space for the work vector.\n");
+void start_waiting(ralloc_ctx* ctx, int pid) {
+    ctx->detector.waiting[pid] = 1;
+    update_vector(&ctx->detector.work, ctx->banker.allocation[pid], ctx->banker.M, -1);
+    ctx->detector.dirty = 1; // a deadlock can only form when a process starts waiting
+}
+
+/**
+ * Marks a waiting process as running again, must be called before its request
+ * is granted so that its allocation is added back to the work vector.
+ * @param pid The id of the process whose request can now be granted
+ */
+void stop_waiting(ralloc_ctx* ctx, int pid) {
+    ctx->detector.waiting[pid] = 0;
+    update_vector(&ctx->detector.work, ctx->banker.allocation[pid], ctx->banker.M, 1);
+}
+
+/**
+ * Computes which processes are deadlocked. Running processes are assumed to
+ * finish, hence the pass starts from the maintained work vector and only visits
+ * the waiting processes, without copying the allocation and need matrices. The
+ * result is cached until another process starts waiting.
+ * @return num_deadlocked: Number of deadlocked processes, the deadlocked set is
+ *         kept in ctx->detector.deadlocked (1 for deadlocked, -1 otherwise)
+ */
+int detect_deadlock(ralloc_ctx* ctx) {
+    if (!ctx->detector.dirty) {
+        return ctx->detector.num_deadlocked;
+    }
+    for (int i = 0; i < ctx->banker.M; i++) {
+        ctx->detector.scratch[i] = ctx->detector.work[i];
+    }
+    for (int i = 0; i < ctx->banker.N; i++) {
+        ctx->detector.finish[i] = !ctx->detector.waiting[i];
+    }
+    for (int i = 0; i < ctx->banker.N; i++) {
+        if (!ctx->detector.finish[i] && can_finish(ctx, i, ctx->detector.scratch)) {
+            update_vector(&ctx->detector.scratch, ctx->banker.allocation[i], ctx->banker.M, 1);
+            ctx->detector.finish[i] = 1;
+            i = -1;
+        }
+    }
+    ctx->detector.num_deadlocked = 0;
+    for (int i = 0; i < ctx->banker.N; i++) {
+        if (ctx->detector.finish[i] == 0) { // process cannot finish
+            ctx->detector.num_deadlocked++;
+            ctx->detector.deadlocked[i] = 1;
+        } else {
+            ctx->detector.deadlocked[i] = -1;
+        }
+    }
+    ctx->detector.dirty = 0;
+    if (ctx->detector.num_deadlocked > 0) {
+        add_stat(&ctx->stats.detections, 1);
+    }
+    return ctx->detector.num_deadlocked;
+}
+
+/**
+ * Chooses the deadlocked process that is the cheapest to abort according to
+ * the recovery method. Ties are broken in favor of the lowest process id.
+ * @return The id of the victim process
+ */
+int select_victim(ralloc_ctx* ctx) {
+    int victim = -1;
+    long victim_cost = 0;
+    for (int i = 0; i < ctx->banker.N; i++) {
+        if (ctx->detector.deadlocked[i] != 1) {
+            continue;
+        }
+        long cost = 0;
+        if (ctx->detector.recovery == RECOVERY_MIN_HELD) {
+            for (int j = 0; j < ctx->banker.M; j++) {
+                cost += ctx->banker.allocation[i][j];
+            }
+        } else if (ctx->detector.recovery == RECOVERY_YOUNGEST) {
+            cost = -__atomic_load_n(&ctx->detector.start[i], __ATOMIC_RELAXED);
+        } else if (ctx->detector.recovery == RECOVERY_PRIORITY) {
+            cost = ctx->detector.priority[i];
+        }
+        if (victim == -1 || cost < victim_cost) {
+            victim = i;
+            victim_cost = cost;
+        }
+    }
+    return victim;
+}
+
+/**
+ * Aborts the pending request of a waiting process and reclaims everything
+ * allocated to it, the aborted request returns RALLOC_ABORTED.
+ * @param pid The id of the victim process
+ */
+void abort_process(ralloc_ctx* ctx, int pid) {
+    trace_call(ctx, RALLOC_TRACE_ABORT, pid, NULL);
+    stop_waiting(ctx, pid);
+    begin_write(ctx, NULL);
+    update_vector(&ctx->banker.available, ctx->banker.allocation[pid], ctx->banker.M, 1);
+    for (int i = 0; i < ctx->banker.M; i++) {
+        ctx->banker.allocation[pid][i] = 0;
+        ctx->banker.need[pid][i] = 0;
+    }
+    end_write(ctx, NULL);
+    ctx->detector.aborted[pid] = 1;
+    ctx->detector.dirty = 1; // the waiting set changed
+}
+
+/**
+ * Aborts victims one by one until no process is deadlocked, then wakes the
+ * waiting processes so that the victims return and the others can proceed.
+ * @return Number of aborted processes
+ */
+int recover_deadlock(ralloc_ctx* ctx) {
+    int num_aborted = 0;
+    while (detect_deadlock(ctx) > 0) {
+        abort_process(ctx, select_victim(ctx));
+        num_aborted++;
+    }
+    if (num_aborted > 0) {
+        pthread_cond_broadcast(&ctx->cond);
+    }
+    return num_aborted;
+}
+
+/**
+ * Acquires the locks of the resource types in increasing order.
+ * @param demand Only the types with a positive demand are locked, all types are
+ *               locked if demand is NULL
+ */
+void lock_shards(ralloc_ctx* ctx, int demand[]) {
+    if (ctx->shards == NULL) {
+        return;
+    }
+    for (int i = 0; i < ctx->banker.M; i++) {
+        if (demand == NULL || demand[i] > 0) {
+            pthread_mutex_lock(&ctx->shards[i].lock);
+        }
+    }
+}
+
+/**
+ * Releases the locks acquired by lock_shards with the same demand.
+ * @param demand The demand given to lock_shards
+ */
+void unlock_shards(ralloc_ctx* ctx, int demand[]) {
+    if (ctx->shards == NULL) {
+        return;
+    }
+    for (int i = ctx->banker.M - 1; i >= 0; i--) {
+        if (demand == NULL || demand[i] > 0) {
+            pthread_mutex_unlock(&ctx->shards[i].lock);
+        }
+    }
+}
+
+/**
+ * Finds a resource type that cannot satisfy a demand, reading only the
+ * columns locked by lock_shards(ctx, demand).
+ * @param demand The demand of the requesting process
+ * @return The first type with less available resources than demanded, -1 if
+ *         the demand can be allocated
+ */
+int find_short_type(ralloc_ctx* ctx, int demand[]) {
+    for (int i = 0; i < ctx->banker.M; i++) {
+        if (demand[i] > 0 && demand[i] > ctx->banker.available[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * update_state for the sharded policies, touches only the columns locked by
+ * lock_shards(ctx, to_handle) and leaves the need matrix as it is.
+ * @param pid The id of the process that receives or releases resources
+ * @param to_handle The amount of resources allocated or deallocated
+ * @param op -1 for allocation, 1 for release
+ */
+void update_columns(ralloc_ctx* ctx, int pid, int to_handle[], int op) {
+    begin_write(ctx, to_handle);
+    for (int i = 0; i < ctx->banker.M; i++) {
+        if (to_handle[i] > 0) {
+            ctx->banker.available[i] += to_handle[i] * op;
+            ctx->banker.allocation[pid][i] -= to_handle[i] * op;
+        }
+    }
+    end_write(ctx, to_handle);
+}
+
+/**
+ * ralloc_request for DEADLOCK_NOTHING and DEADLOCK_DETECTION. Only the locks of
+ * the requested resource types are held, so requests for independent types
+ * proceed in parallel. A DEADLOCK_NOTHING request waits on the type it is short
+ * of, a DEADLOCK_DETECTION request that has to wait continues in request_blocking.
+ * @param pid The id of the requesting process
+ * @param demand The demand of the requesting process
+ * @return 0 on success, -1 on error and RALLOC_ABORTED if the request is aborted
+ */
+int request_sharded(ralloc_ctx* ctx, int pid, int demand[]) {
+    if (!validate_pid(ctx, pid)) {
         return -1;
     }
-    int** allocation = NULL; // Work = Available
-    if (!allocate_matrix(&allocation, banker.allocation, banker.N, banker.M)) {
-        printf("Error: Cannot alocate space for the copied allocation matrix.\n");
-        free(work);
+    if (!can_allocate(ctx, demand, ctx->system_max)) {
+        printf("Error: The request exceeds maximum system resources.\n");
         return -1;
     }
-    int** need = NULL;
-    if (!allocate_matrix(&need, banker.need, banker.N, banker.M)) {
-        printf("Error: Cannot alocate space for the copied need matrix.\n");
-        free(work);
-        free_matrix(allocation, banker.N);
+    if (ctx->policy == DEADLOCK_DETECTION) {
+        mark_start(ctx, pid);
+    }
+    lock_shards(ctx, demand);
+    int type;
+    long wait_start = 0;
+    while ((type = find_short_type(ctx, demand)) != -1 && ctx->policy == DEADLOCK_NOTHING) {
+        if (wait_start == 0) {
+            wait_start = now_ns();
+        }
+        // Sleep on the short type only, the others are not held while waiting
+        for (int i = 0; i < ctx->banker.M; i++) {
+            if (demand[i] > 0 && i != type) {
+                pthread_mutex_unlock(&ctx->shards[i].lock);
+            }
+        }
+        pthread_cond_wait(&ctx->shards[type].cond, &ctx->shards[type].lock);
+        pthread_mutex_unlock(&ctx->shards[type].lock);
+        lock_shards(ctx, demand);
+    }
+    if (type == -1) {
+        update_columns(ctx, pid, demand, -1);
+        trace_call(ctx, RALLOC_TRACE_GRANT, pid, demand);
+        unlock_shards(ctx, demand);
+        add_stat(&ctx->stats.grants, 1);
+        if (wait_start != 0) {
+            record_wait(ctx, wait_start);
+        }
+        return 0;
+    }
+    unlock_shards(ctx, demand);
+    return request_blocking(ctx, pid, &demand, 1);
+}
+
+/**
+ * Slow path of a DEADLOCK_DETECTION request and of a sharded ralloc_request_any,
+ * records the request as pending and waits on cond with every lock held except
+ * while sleeping, so that detection and recovery observe a consistent state.
+ * @param pid The id of the requesting process
+ * @param demands The alternative demands of the requesting process, the first
+ *                one that fits in the available resources is granted
+ * @param num_alternatives Number of demands, 1 for ralloc_request
+ * @return The index of the granted demand and RALLOC_ABORTED if the request is aborted
+ */
+int request_blocking(ralloc_ctx* ctx, int pid, int* demands[], int num_alternatives) {
+    int detection = (ctx->policy == DEADLOCK_DETECTION);
+    pthread_mutex_lock(&ctx->lock);
+    lock_shards(ctx, NULL);
+    if (detection) {
+        begin_write(ctx, NULL);
+        for (int i = 0; i < ctx->banker.M; i++) {
+            ctx->banker.need[pid][i] = demands[0][i]; // record the request as pending
+        }
+        end_write(ctx, NULL);
+        ctx->detector.alternatives[pid] = demands;
+        ctx->detector.num_alternatives[pid] = num_alternatives;
+    }
+    int choice = first_fit(ctx, demands, num_alternatives);
+    if (choice == -1) {
+        long wait_start = now_ns();
+        ctx->detector.num_waiting++;
+        if (detection) {
+            start_waiting(ctx, pid);
+        }
+        if (detection && ctx->detector.handler != NULL && detect_deadlock(ctx) > 0
+            && ctx->detector.deadlocked[pid] == 1) {
+            // The request closed a cycle, report it outside the monitor so that
+            // the handler is free to call back into the library
+            int procarray[ctx->banker.N];
+            int num_deadlocked = ctx->detector.num_deadlocked;
+            ralloc_handler handler = ctx->detector.handler;
+            for (int i = 0; i < ctx->banker.N; i++) {
+                procarray[i] = ctx->detector.deadlocked[i];
+            }
+            unlock_shards(ctx, NULL);
+            pthread_mutex_unlock(&ctx->lock);
+            handler(procarray, num_deadlocked);
+            pthread_mutex_lock(&ctx->lock);
+            lock_shards(ctx, NULL);
+        }
+        if (detection && ctx->detector.recovery != RECOVERY_NONE) {
+            recover_deadlock(ctx);
+        }
+        while (!(detection && ctx->detector.aborted[pid])
+               && (choice = first_fit(ctx, demands, num_alternatives)) == -1) {
+            unlock_shards(ctx, NULL);
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+            lock_shards(ctx, NULL);
+        }
+        ctx->detector.num_waiting--;
+        record_wait(ctx, wait_start);
+        if (detection && ctx->detector.aborted[pid]) { // chosen as a victim, allocations are reclaimed
+            ctx->detector.aborted[pid] = 0;
+            ctx->detector.alternatives[pid] = NULL;
+            unlock_shards(ctx, NULL);
+            pthread_mutex_unlock(&ctx->lock);
+            return RALLOC_ABORTED;
+        }
+        if (detection) {
+            stop_waiting(ctx, pid);
+        }
+    }
+    if (detection) {
+        begin_write(ctx, NULL);
+        for (int i = 0; i < ctx->banker.M; i++) {
+            ctx->banker.need[pid][i] = demands[choice][i]; // the demand that is granted
+        }
+        end_write(ctx, NULL);
+        ctx->detector.alternatives[pid] = NULL;
+    }
+    update_state(ctx, pid, demands[choice], -1);
+    trace_call(ctx, RALLOC_TRACE_GRANT, pid, demands[choice]);
+    add_stat(&ctx->stats.grants, 1);
+    unlock_shards(ctx, NULL);
+    pthread_mutex_unlock(&ctx->lock);
+    return choice;
+}
+
+/**
+ * Finds the first demand that fits in the available resources, reading only
+ * the columns of the demands.
+ * @param demands The alternative demands
+ * @param num_alternatives Number of demands
+ * @return The index of the demand, -1 if none fits
+ */
+int first_fit(ralloc_ctx* ctx, int* demands[], int num_alternatives) {
+    for (int a = 0; a < num_alternatives; a++) {
+        if (find_short_type(ctx, demands[a]) == -1) {
+            return a;
+        }
+    }
+    return -1;
+}
+
+/**
+ * ralloc_request_any for DEADLOCK_NOTHING and DEADLOCK_DETECTION. The locks of
+ * every resource type used by the alternatives are taken once, and the first
+ * demand that fits is granted; otherwise the request waits in request_blocking.
+ * @param pid The id of the requesting process
+ * @param demands The alternative demands
+ * @param num_alternatives Number of demands
+ * @return The index of the granted demand and RALLOC_ABORTED if the request is aborted
+ */
+int request_any_sharded(ralloc_ctx* ctx, int pid, int* demands[], int num_alternatives) {
+    int columns[ctx->banker.M]; // union of the alternatives
+    for (int i = 0; i < ctx->banker.M; i++) {
+        columns[i] = 0;
+        for (int a = 0; a < num_alternatives; a++) {
+            columns[i] |= (demands[a][i] > 0);
+        }
+    }
+    if (ctx->policy == DEADLOCK_DETECTION) {
+        mark_start(ctx, pid);
+    }
+    lock_shards(ctx, columns);
+    int choice = first_fit(ctx, demands, num_alternatives);
+    if (choice != -1) {
+        update_columns(ctx, pid, demands[choice], -1);
+        trace_call(ctx, RALLOC_TRACE_GRANT, pid, demands[choice]);
+        unlock_shards(ctx, columns);
+        add_stat(&ctx->stats.grants, 1);
+        return choice;
+    }
+    unlock_shards(ctx, columns);
+    return request_blocking(ctx, pid, demands, num_alternatives);
+}
+
+/**
+ * Checks whether the pending request of a waiting DEADLOCK_DETECTION process
+ * can be satisfied by a work vector, any of the demands of a ralloc_request_any
+ * is enough.
+ * @param pid The id of the waiting process
+ * @param work The work vector of the detection pass
+ * @return 1 if the process can finish, 0 otherwise
+ */
+int can_finish(ralloc_ctx* ctx, int pid, int work[]) {
+    if (ctx->detector.alternatives[pid] == NULL) {
+        return can_allocate(ctx, ctx->banker.need[pid], work);
+    }
+    for (int a = 0; a < ctx->detector.num_alternatives[pid]; a++) {
+        if (can_allocate(ctx, ctx->detector.alternatives[pid][a], work)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * ralloc_release for DEADLOCK_NOTHING and DEADLOCK_DETECTION, holds only the
+ * locks of the released resource types. The global lock is taken only to wake
+ * the requests waiting in request_blocking.
+ * @param pid The id of the releasing process
+ * @param demand The resources released by the process
+ * @return 0 on success, -1 on error
+ */
+int release_sharded(ralloc_ctx* ctx, int pid, int demand[]) {
+    if (!validate_pid(ctx, pid)) {
         return -1;
     }
-    int* finish = NULL;
-    if (!allocate_vector(&finish, NULL, banker.N)) {
-        printf("Error: Cannot alocate space for the finish vector.\n");
-        free(work);
-        free_matrix(allocation, banker.N);
-        free_matrix(need, banker.N);
+    lock_shards(ctx, demand);
+    if (!can_allocate(ctx, demand, ctx->banker.allocation[pid])) {
+        printf("Error: Process %d tries to release more resources than it owns.\n", pid);
+        unlock_shards(ctx, demand);
         return -1;
     }
-    for (int i = 0; i < banker.N; i++) {
-        if (can_allocate(need[i], work) && !finish[i]) {
-            update_vector(&work, allocation[i], banker.M, 1);
-            finish[i] = 1;
-            i = -1;
+    update_columns(ctx, pid, demand, 1);
+    for (int i = 0; i < ctx->banker.M; i++) {
+        if (demand[i] > 0) {
+            pthread_cond_broadcast(&ctx->shards[i].cond);
         }
     }
-    int num_deadlocked = 0;
-    for (int i = 0; i < banker.N; i++) {
-        if (finish[i] == 0) { // process cannot finish
-            num_deadlocked++;
-            procarray[i] = 1;
-        } else {
-            procarray[i] = -1;
-        }
+    int wake = (ctx->detector.num_waiting > 0);
+    unlock_shards(ctx, demand);
+    if (wake) {
+        pthread_mutex_lock(&ctx->lock);
+        pthread_cond_broadcast(&ctx->cond);
+        pthread_mutex_unlock(&ctx->lock);
     }
-    free(finish);
-    free(work);
-    free_matrix(allocation, banker.N);
-    free_matrix(need, banker.N);
-    return num_deadlocked;
+    return 0;
 }
 
 /**
- * Frees the heap memory occupied by a 2D array.
+ * Frees the heap memory occupied by a 2D array, the rows that were
+ * never allocated must be NULL.
  * @param matrix The pointer to the 2D array
  * @param num_rows Number of arrays in the 2D array
  */
 void free_matrix(int* matrix[], int num_rows) {
+    if (matrix == NULL) {
+        return;
+    }
     for (int i = 0; i < num_rows; i++) {
         free(matrix[i]);
     }
     free(matrix);
 }
 
+/**
+ * Frees the heap memory occupied by a context and by every state vector and
+ * matrix allocated for it, the ones that were never allocated must be NULL.
+ * @param ctx The context to be freed
+ */
+void free_state(ralloc_ctx* ctx) {
+    free(ctx->system_max);
+    free(ctx->banker.available);
+    free_matrix(ctx->banker.max_demand, ctx->banker.N);
+    free_matrix(ctx->banker.allocation, ctx->banker.N);
+    free_matrix(ctx->banker.need, ctx->banker.N);
+    free(ctx->detector.waiting);
+    free(ctx->detector.work);
+    free(ctx->detector.scratch);
+    free(ctx->detector.finish);
+    free(ctx->detector.deadlocked);
+    free(ctx->detector.priority);
+    free(ctx->detector.start);
+    free(ctx->detector.aborted);
+    free(ctx->detector.num_alternatives);
+    free(ctx->detector.alternatives);
+    free(ctx->batch.waiting);
+    free(ctx->batch.position);
+    free_matrix(ctx->batch.slack, ctx->banker.N);
+    free(ctx->batch.work);
+    free(ctx->batch.finish);
+    free(ctx->shards);
+    free(ctx->version);
+    free(ctx->sequence);
+    free(ctx);
+}
+
+/**
+ * Fills the position and slack vectors of ctx->batch (see safe_sequence) for
+ * the cached safe sequence, which takes a single pass if the sequence is still
+ * safe. A new sequence is searched for otherwise.
+ * @param ctx The context whose state is checked
+ * @return 1 if the current state is safe, 0 otherwise
+ */
+int sequence_slack(ralloc_ctx* ctx) {
+    long check_start = now_ns();
+    int* work = ctx->batch.work;
+    for (int j = 0; j < ctx->banker.M; j++) {
+        work[j] = ctx->banker.available[j];
+    }
+    for (int k = 0; k < ctx->banker.N; k++) {
+        int i = ctx->sequence[k];
+        if (!can_allocate(ctx, ctx->banker.need[i], work)) {
+            add_stat(&ctx->stats.fast_path_misses, 1);
+            return safe_sequence(ctx);
+        }
+        for (int j = 0; j < ctx->banker.M; j++) {
+            ctx->batch.slack[k][j] = work[j] - ctx->banker.need[i][j];
+        }
+        ctx->batch.position[i] = k;
+        update_vector(&work, ctx->banker.allocation[i], ctx->banker.M, 1);
+    }
+    ctx->batch.valid = 1;
+    add_stat(&ctx->stats.fast_path_hits, 1);
+    add_stat(&ctx->stats.safety_checks, 1);
+    add_stat(&ctx->stats.safety_ns, now_ns() - check_start);
+    return 1;
+}
+
+/**
+ * Chooses the first alternative of a DEADLOCK_AVOIDANCE ralloc_request_any
+ * that can be granted safely. A single safe sequence of the current state is
+ * enough to test every alternative: granting Demand to the process at position
+ * k keeps the sequence safe if Demand fits in the available resources and in
+ * the slack of the positions before k. The sequence kept in ctx->batch is used
+ * if it is still valid. The alternatives are checked one by one
+ * with is_safe_avoidance only if none passes this test. Alternatives exceeding
+ * the need of the process are never chosen.
+ * @param pid The id of the requesting process
+ * @param demands The alternative demands
+ * @param num_alternatives Number of demands
+ * @return The index of the demand, -1 if none can be granted now and -2 on error
+ */
+int choose_alternative(ralloc_ctx* ctx, int pid, int* demands[], int num_alternatives) {
+    int eligible[num_alternatives];
+    int num_eligible = 0;
+    for (int a = 0; a < num_alternatives; a++) {
+        eligible[a] = can_allocate(ctx, demands[a], ctx->banker.need[pid]);
+        num_eligible += eligible[a];
+    }
+    if (num_eligible == 0) {
+        printf("Error: Process requested more than the need it reported.\n");
+        return -2;
+    }
+    if (ctx->batch.valid || sequence_slack(ctx)) {
+        for (int a = 0; a < num_alternatives; a++) {
+            if (eligible[a] && fits_plan(ctx, pid, demands[a])) {
+                return a;
+            }
+        }
+    }
+    for (int a = 0; a < num_alternatives; a++) {
+        if (eligible[a] && is_safe_avoidance(ctx, pid, demands[a]) == 1) {
+            return a;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Computes a safe sequence of the current state, placing the processes with a
+ * pending request as early as possible. Besides the order, the slack of each
+ * position (Work - Need of the process at that position, where Work is the work
+ * vector when the process is reached) is kept for wait_pending, and kept up to
+ * date by update_plan until a grant does not fit it.
+ * @param ctx The context whose state is checked
+ * @return 1 if the current state is safe, 0 otherwise
+ */
+int safe_sequence(ralloc_ctx* ctx) {
+    long check_start = now_ns();
+    int* work = ctx->batch.work;
+    int* finish = ctx->batch.finish;
+    for (int i = 0; i < ctx->banker.M; i++) {
+        work[i] = ctx->banker.available[i];
+    }
+    for (int i = 0; i < ctx->banker.N; i++) {
+        finish[i] = 0;
+    }
+    int length = 0;
+    while (length < ctx->banker.N) {
+        int next = -1;
+        for (int i = 0; i < ctx->banker.N; i++) {
+            if (!finish[i] && can_allocate(ctx, ctx->banker.need[i], work)) {
+                if (ctx->batch.waiting[i]) {
+                    next = i;
+                    break;
+                }
+                if (next == -1) {
+                    next = i;
+                }
+            }
+        }
+        if (next == -1) { // no process can finish
+            break;
+        }
+        for (int j = 0; j < ctx->banker.M; j++) {
+            ctx->batch.slack[length][j] = work[j] - ctx->banker.need[next][j];
+        }
+        ctx->batch.position[next] = length;
+        update_vector(&work, ctx->banker.allocation[next], ctx->banker.M, 1);
+        finish[next] = 1;
+        length++;
+    }
+    if (length == ctx->banker.N) { // also a good guess for is_safe_avoidance
+        for (int i = 0; i < ctx->banker.N; i++) {
+            ctx->sequence[ctx->batch.position[i]] = i;
+        }
+    }
+    ctx->batch.valid = (length == ctx->banker.N);
+    add_stat(&ctx->stats.safety_checks, 1);
+    add_stat(&ctx->stats.safety_ns, now_ns() - check_start);
+    return length == ctx->banker.N;
+}
+
+/**
+ * Queues a DEADLOCK_AVOIDANCE request that cannot be granted safely and waits
+ * until a release picks it, see wake_pending. A picked request only confirms
+ * that it still fits the safe sequence of ctx->batch (fits_plan), which holds
+ * unless another grant broke the sequence in between; is_safe_avoidance is
+ * called otherwise and for the requests woken to recheck.
+ * @param ctx The context of the request
+ * @param pid The id of the requesting process
+ * @param demand The request
+ * @return 1 if the request can be granted, -1 if it became invalid
+ */
+int wait_pending(ralloc_ctx* ctx, int pid, int demand[]) {
+    Pending entry = {pid, demand, WAKE_NONE, PTHREAD_COND_INITIALIZER, NULL};
+    if (ctx->pending_tail == NULL) {
+        ctx->pending_head = &entry;
+    } else {
+        ctx->pending_tail->next = &entry;
+    }
+    ctx->pending_tail = &entry;
+    ctx->batch.waiting[pid] = 1;
+    int safe = 0;
+    while (safe == 0) {
+        pthread_cond_wait(&entry.cond, &ctx->lock);
+        int wake = entry.wake;
+        entry.wake = WAKE_NONE;
+        if (wake == WAKE_NONE) {
+            continue; // spurious wakeup
+        }
+        long check_start = now_ns();
+        if (wake == WAKE_GRANTABLE && ctx->batch.valid && fits_plan(ctx, pid, demand)) {
+            add_stat(&ctx->stats.fast_path_hits, 1);
+            add_stat(&ctx->stats.safety_checks, 1);
+            add_stat(&ctx->stats.safety_ns, now_ns() - check_start);
+            safe = 1;
+        } else {
+            safe = is_safe_avoidance(ctx, pid, demand);
+        }
+    }
+    remove_pending(ctx, &entry);
+    ctx->batch.waiting[pid] = 0;
+    pthread_cond_destroy(&entry.cond);
+    return safe;
+}
+
+/**
+ * Wakes the queued DEADLOCK_AVOIDANCE requests after a release, picking the
+ * ones to grant with a single pass over the safe sequence of ctx->batch instead
+ * of one safety check per waiter. Granting Demand to the process at position k
+ * lowers the slack of the positions before k by Demand, so the requests are
+ * picked greedily in FIFO order while they fit in the available resources and
+ * in the slack left by the requests picked before them. The sequence is kept
+ * up to date by update_plan and only computed again (sequence_slack) if a
+ * grant dropped it, so a release costs one pass while it stays valid. The
+ * picked requests are granted by their own threads. A request that is
+ * not picked is woken to recheck itself only if its process can finish with
+ * the available resources (such a request is always safe); the others sleep
+ * until a later release, even if some other safe sequence would allow them.
+ * @param ctx The context of the release
+ */
+void wake_pending(ralloc_ctx* ctx) {
+    if (!ctx->batch.enabled) { // queued before batching was disabled
+        for (Pending* p = ctx->pending_head; p != NULL; p = p->next) {
+            p->wake = WAKE_RECHECK;
+            pthread_cond_signal(&p->cond);
+        }
+        return;
+    }
+    Pending* p = ctx->pending_head;
+    while (p != NULL && !can_allocate(ctx, p->demand, ctx->banker.available)) {
+        p = p->next; // such a request can neither be picked nor rechecked
+    }
+    if (p == NULL) {
+        return;
+    }
+    if (!ctx->batch.valid && !sequence_slack(ctx)) {
+        return;
+    }
+    pick_pending(ctx);
+    for (p = ctx->pending_head; p != NULL; p = p->next) {
+        if (p->wake == WAKE_GRANTABLE) {
+            update_plan(ctx, p->pid, p->demand, 1); // the picks are granted by the waiters
+        } else if (can_allocate(ctx, ctx->banker.need[p->pid], ctx->banker.available)) {
+            p->wake = WAKE_RECHECK;
+        }
+        if (p->wake != WAKE_NONE) {
+            pthread_cond_signal(&p->cond);
+        }
+    }
+}
+
+/**
+ * Picks the pending requests that a release grants (see wake_pending), marking
+ * them WAKE_GRANTABLE. The slack of ctx->batch is lowered by every pick and
+ * ctx->batch.work holds the resources left available by the picks.
+ * @param ctx The context of the release
+ */
+void pick_pending(ralloc_ctx* ctx) {
+    long check_start = now_ns();
+    int* available = ctx->batch.work;
+    for (int j = 0; j < ctx->banker.M; j++) {
+        available[j] = ctx->banker.available[j];
+    }
+    for (Pending* p = ctx->pending_head; p != NULL; p = p->next) {
+        p->wake = WAKE_NONE; // earlier picks that did not run yet are replaced
+        int position = ctx->batch.position[p->pid];
+        int fits = can_allocate(ctx, p->demand, available)
+            && can_allocate(ctx, p->demand, ctx->banker.need[p->pid]);
+        for (int k = 0; k < position && fits; k++) {
+            fits = can_allocate(ctx, p->demand, ctx->batch.slack[k]);
+        }
+        if (fits) {
+            update_vector(&available, p->demand, ctx->banker.M, -1);
+            for (int k = 0; k < position; k++) {
+                update_vector(&ctx->batch.slack[k], p->demand, ctx->banker.M, -1);
+            }
+            p->wake = WAKE_GRANTABLE;
+        }
+    }
+    add_stat(&ctx->stats.safety_checks, 1);
+    add_stat(&ctx->stats.safety_ns, now_ns() - check_start);
+}
+
+/**
+ * Removes a request from the queue of the waiting DEADLOCK_AVOIDANCE requests.
+ * @param ctx The context of the request
+ * @param entry The queue entry of the request
+ */
+void remove_pending(ralloc_ctx* ctx, Pending* entry) {
+    Pending* prev = NULL;
+    for (Pending* p = ctx->pending_head; p != entry; p = p->next) {
+        prev = p;
+    }
+    if (prev == NULL) {
+        ctx->pending_head = entry->next;
+    } else {
+        prev->next = entry->next;
+    }
+    if (ctx->pending_tail == entry) {
+        ctx->pending_tail = prev;
+    }
+}
+
+/**
+ * Returns the current time of the monotonic clock.
+ * @return The current time in nanoseconds
+ */
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Atomically adds an amount to one of the statistics counters, the counters
+ * are also updated by the sharded paths that do not hold the global lock.
+ * @param counter The counter to be updated
+ * @param amount The amount to be added
+ */
+void add_stat(long* counter, long amount) {
+    __atomic_add_fetch(counter, amount, __ATOMIC_RELAXED);
+}
+
+/**
+ * Accounts a request that had to wait.
+ * @param ctx The context of the request
+ * @param wait_start The time at which the request started waiting
+ */
+void record_wait(ralloc_ctx* ctx, long wait_start) {
+    add_stat(&ctx->stats.waits, 1);
+    add_stat(&ctx->stats.wait_ns, now_ns() - wait_start);
+}
+
+/**
+ * Records the logical time at which a DEADLOCK_DETECTION process starts holding
+ * resources, used by RECOVERY_YOUNGEST. Only the thread of the process changes
+ * its allocation while it is running, so no lock is needed.
+ * @param pid The id of the requesting process
+ */
+void mark_start(ralloc_ctx* ctx, int pid) {
+    int holding = 0;
+    for (int i = 0; i < ctx->banker.M; i++) {
+        holding |= ctx->banker.allocation[pid][i];
+    }
+    if (!holding) { // the process is born again
+        __atomic_store_n(&ctx->detector.start[pid],
+            __atomic_add_fetch(&ctx->detector.clock, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Appends a call to the trace of the context if tracing is enabled.
+ * @param op The traced call, one of RALLOC_TRACE_*
+ * @param pid The id of the calling process, -1 if the call has none
+ * @param vector The vector argument of the call, NULL if the call has none
+ */
+void trace_call(ralloc_ctx* ctx, int op, int pid, int vector[]) {
+    trace_calls(ctx, op, pid, &vector, 1);
+}
+
+/**
+ * Appends a call with several vector arguments to the trace, as one record
+ * per vector with no other call in between. The records after the first one
+ * are RALLOC_TRACE_ALTERNATIVE.
+ * @param op The traced call, one of RALLOC_TRACE_*
+ * @param pid The id of the calling process, -1 if the call has none
+ * @param vectors The vector arguments of the call
+ * @param num_vectors Number of vectors
+ */
+void trace_calls(ralloc_ctx* ctx, int op, int pid, int* vectors[], int num_vectors) {
+    if (__atomic_load_n(&ctx->trace, __ATOMIC_ACQUIRE) == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&ctx->trace_lock);
+    if (ctx->trace != NULL) {
+        ralloc_trace_record record = {now_ns() - ctx->trace_start, op, pid};
+        int values[ctx->banker.M];
+        for (int v = 0; v < num_vectors; v++) {
+            for (int i = 0; i < ctx->banker.M; i++) {
+                values[i] = (vectors[v] != NULL) ? vectors[v][i] : 0;
+            }
+            fwrite(&record, sizeof(record), 1, ctx->trace);
+            fwrite(values, sizeof(int), ctx->banker.M, ctx->trace);
+            record.op = RALLOC_TRACE_ALTERNATIVE;
+        }
+    }
+    pthread_mutex_unlock(&ctx->trace_lock);
+}
+
+/**
+ * Appends a call with a single integer argument to the trace, the argument is
+ * the first value of the vector.
+ * @param op The traced call, one of RALLOC_TRACE_*
+ * @param pid The id of the calling process, -1 if the call has none
+ * @param value The argument of the call
+ */
+void trace_value(ralloc_ctx* ctx, int op, int pid, int value) {
+    int vector[ctx->banker.M];
+    for (int i = 0; i < ctx->banker.M; i++) {
+        vector[i] = (i == 0) ? value : 0;
+    }
+    trace_call(ctx, op, pid, vector);
+}
+
+/**
+ * Marks the columns of resource types as being written, concurrent snapshots
+ * retry until end_write. Writers of a column hold its lock (the global lock
+ * under DEADLOCK_AVOIDANCE), so the versions need no atomic increments.
+ * @param columns Only the types with a positive entry are marked, all types
+ *                are marked if columns is NULL
+ */
+void begin_write(ralloc_ctx* ctx, int columns[]) {
+    for (int i = 0; i < ctx->banker.M; i++) {
+        if (columns == NULL || columns[i] > 0) {
+            __atomic_store_n(&ctx->version[i], ctx->version[i] + 1, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Ends a write started by begin_write with the same columns.
+ * @param columns The columns given to begin_write
+ */
+void end_write(ralloc_ctx* ctx, int columns[]) {
+    for (int i = 0; i < ctx->banker.M; i++) {
+        if (columns == NULL || columns[i] > 0) {
+            __atomic_store_n(&ctx->version[i], ctx->version[i] + 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
 // Rest is printing functions for debugging purposes
 
 void print_vector(int size, int vector[]) {
@@ -467,25 +1941,27 @@ void print_matrix(int num_rows, int num_cols, int* matrix[]) {
     }
 }
 
-void print_curr_state() {
-    pthread_mutex_lock(&lock);
+void print_curr_state(ralloc_ctx* ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    lock_shards(ctx, NULL);
     printf("-------------- CURRENT STATE --------------\n");
-    printf("POLICY = %d\n", policy);
-    printf("\nN = %d\nM = %d\n", banker.N, banker.M);
+    printf("POLICY = %d\n", ctx->policy);
+    printf("\nN = %d\nM = %d\n", ctx->banker.N, ctx->banker.M);
     printf("\nSYSTEM RESOURCES: \n");
-    print_vector(banker.M, system_max);
+    print_vector(ctx->banker.M, ctx->system_max);
     printf("\nAVAILABLE VECTOR: \n");
-    print_vector(banker.M, banker.available);
+    print_vector(ctx->banker.M, ctx->banker.available);
     printf("\nALLOCATON MATRIX: \n");
-    print_matrix(banker.N, banker.M, banker.allocation);
-    if (banker.max_demand != NULL) {
+    print_matrix(ctx->banker.N, ctx->banker.M, ctx->banker.allocation);
+    if (ctx->banker.max_demand != NULL) {
         printf("\nMAX DEMAND MATRIX: \n");
-        print_matrix(banker.N, banker.M, banker.max_demand);
+        print_matrix(ctx->banker.N, ctx->banker.M, ctx->banker.max_demand);
     }
-    if (banker.need != NULL) {
+    if (ctx->banker.need != NULL) {
         printf("\nNEED MATRIX: \n");
-        print_matrix(banker.N, banker.M, banker.need);
+        print_matrix(ctx->banker.N, ctx->banker.M, ctx->banker.need);
     }
     printf("-------------------------------------------\n");
-    pthread_mutex_unlock(&lock);
+    unlock_shards(ctx, NULL);
+    pthread_mutex_unlock(&ctx->lock);
 }
@@ -13,16 +13,121 @@
 
 #define MAX_RESOURCE_TYPES 10 
 #define MAX_PROCESSES 20 
+#define MAX_RESOURCE_GROUPS 10
 
 #define DEADLOCK_NOTHING   1
 #define DEADLOCK_DETECTION 2
 #define DEADLOCK_AVOIDANCE 3
 
+#define RECOVERY_NONE     0 // deadlocked processes stay blocked
+#define RECOVERY_MIN_HELD 1 // abort the process holding the fewest resources
+#define RECOVERY_YOUNGEST 2 // abort the process that started holding resources last
+#define RECOVERY_PRIORITY 3 // abort the process with the lowest ralloc_priority
+
+#define RALLOC_ABORTED -2 // returned by a request aborted to recover from a deadlock
+#define RALLOC_WOULDBLOCK -3 // returned by ralloc_try_request instead of waiting
+
+// Calls recorded by ralloc_trace
+#define RALLOC_TRACE_MAXDEMAND   1
+#define RALLOC_TRACE_REQUEST     2
+#define RALLOC_TRACE_RELEASE     3
+#define RALLOC_TRACE_DETECTION   4
+#define RALLOC_TRACE_TRY_REQUEST 5
+#define RALLOC_TRACE_REQUEST_ANY 6 // the first demand, the others follow as alternatives
+#define RALLOC_TRACE_ALTERNATIVE 7
+#define RALLOC_TRACE_RECOVERY    8
+#define RALLOC_TRACE_PRIORITY    9
+#define RALLOC_TRACE_ABORT       10 // a waiting process chosen as a victim by the recovery
+#define RALLOC_TRACE_GRANT       11 // a request is granted, with the granted demand
+
+#define RALLOC_TRACE_MAGIC 0x52414c43 // "RALC"
+
+/**
+ * Deadlock handler, called by the request that closes a cycle with the
+ * deadlocked set (1 for deadlocked, -1 otherwise) and its size.
+ */
+typedef void (*ralloc_handler)(int procarray[], int num_deadlocked);
+
+/**
+ * Cumulative counters of an allocator.
+ */
+typedef struct {
+    long safety_checks; // number of DEADLOCK_AVOIDANCE safety checks
+    long safety_ns; // time spent in the safety checks in nanoseconds
+    long waits; // number of requests that had to wait
+    long wait_ns; // time spent waiting by the requests in nanoseconds
+    long grants; // number of granted requests
+    long unsafe_rejections; // number of DEADLOCK_AVOIDANCE checks that found a request unsafe
+    long detections; // number of DEADLOCK_DETECTION passes that found a deadlock
+    long fast_path_hits; // safety checks answered by the cached safe sequence
+    long fast_path_misses; // safety checks that needed a full search
+} ralloc_stats;
+
+/**
+ * Header of a trace file written by ralloc_trace. It is followed by one
+ * ralloc_trace_record per call, each followed by the r_count values of the
+ * vector argument of the call (zeros for ralloc_detection and aborts, the
+ * method or the priority first for ralloc_recovery and ralloc_priority). A
+ * ralloc_request_any is one record per demand, written together. A request is
+ * recorded when it is made and again when it is granted or aborted. The
+ * recovery method and priorities in effect when the trace starts come first.
+ * The layout is the one of the recording machine.
+ */
+typedef struct {
+    int magic; // RALLOC_TRACE_MAGIC
+    int p_count;
+    int r_count;
+    int d_handling;
+    int r_exist[MAX_RESOURCE_TYPES];
+} ralloc_trace_header;
+
+typedef struct {
+    long time_ns; // time of the call since the trace started
+    int op; // RALLOC_TRACE_*
+    int pid; // -1 for ralloc_detection
+} ralloc_trace_record;
+
+/**
+ * An independent allocator with its own state and locks.
+ */
+typedef struct ralloc_ctx ralloc_ctx;
+
+ralloc_ctx* ralloc_ctx_init(int p_count, int r_count, int r_exist[], int d_handling);
+int ralloc_ctx_maxdemand(ralloc_ctx* ctx, int pid, int r_max[]);
+int ralloc_ctx_request(ralloc_ctx* ctx, int pid, int demand[]);
+int ralloc_ctx_try_request(ralloc_ctx* ctx, int pid, int demand[]);
+int ralloc_ctx_request_any(ralloc_ctx* ctx, int pid, int* demands[], int num_alternatives);
+int ralloc_ctx_group(ralloc_ctx* ctx, int group, int types[], int num_types);
+int ralloc_ctx_request_group(ralloc_ctx* ctx, int pid, int group, int amount);
+int ralloc_ctx_release(ralloc_ctx* ctx, int pid, int demand[]);
+int ralloc_ctx_detection(ralloc_ctx* ctx, int procarray[]);
+int ralloc_ctx_detection_handler(ralloc_ctx* ctx, ralloc_handler handler);
+int ralloc_ctx_recovery(ralloc_ctx* ctx, int method);
+int ralloc_ctx_priority(ralloc_ctx* ctx, int pid, int priority);
+int ralloc_ctx_batching(ralloc_ctx* ctx, int enabled);
+int ralloc_ctx_stats(ralloc_ctx* ctx, ralloc_stats* stats);
+int ralloc_ctx_snapshot(ralloc_ctx* ctx, int available[], int allocation[], int need[],
+                        ralloc_stats* stats);
+int ralloc_ctx_trace(ralloc_ctx* ctx, const char* path);
+int ralloc_ctx_end(ralloc_ctx* ctx);
+
+// Same as above, on a default context created by ralloc_init
 int ralloc_init(int p_count, int r_count, int r_exist[], int d_handling); 
 int ralloc_maxdemand(int pid, int r_max[]);
 int ralloc_request(int pid, int demand[]);
+int ralloc_try_request(int pid, int demand[]);
+int ralloc_request_any(int pid, int* demands[], int num_alternatives);
+int ralloc_group(int group, int types[], int num_types);
+int ralloc_request_group(int pid, int group, int amount);
 int ralloc_release(int pid, int demand[]);
 int ralloc_detection(int procarray[]);
+int ralloc_detection_handler(ralloc_handler handler);
+int ralloc_recovery(int method);
+int ralloc_priority(int pid, int priority);
+int ralloc_batching(int enabled);
+int ralloc_stats_get(ralloc_stats* stats);
+int ralloc_snapshot(int available[], int allocation[], int need[], ralloc_stats* stats);
+int ralloc_trace(const char* path);
 int ralloc_end();
 
 #endif /* RALLOC_H */
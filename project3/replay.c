@@ -0,0 +1,322 @@
+/**
+ * CS342 Spring 2019 - Project 3
+ * Replays a trace written by ralloc_trace on a fresh context, in a single thread,
+ * so that the same workload can be profiled under every deadlock handling method
+ * without depending on the scheduling of the recorded run. The calls of each
+ * process keep their order; a request that would block (ralloc_try_request)
+ * defers the rest of its process until a release lets it through. A request
+ * is not tried before it was granted in the recorded run, and the aborts of
+ * the recorded run are replayed, so that the grants follow the recorded
+ * schedule and its victims go on.
+ * @author Yusuf Dalva - 21602867
+ * @author Efe Acer - 21602217
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ralloc.h"
+#include <time.h> // for measuring the time spent in the library
+
+typedef struct {
+    ralloc_trace_record record;
+    int vector[MAX_RESOURCE_TYPES];
+    int resumed; // the grant or abort of the request in the trace, -1 if there is none
+    int aborted; // 1 if the wait ended with an abort
+} Call;
+
+// Function Declerations
+int load_trace(char* path);
+void link_waits();
+void replay(int method);
+int replay_call(ralloc_ctx* ctx, int method, Call* call);
+int reclaim(ralloc_ctx* ctx, int pid);
+long wall_time_ns();
+
+// Global Variables
+ralloc_trace_header header;
+Call* calls = NULL; // the calls in the order they were recorded
+int num_calls = 0;
+
+int main(int argc, char** argv) {
+    int method = 0; // 0 replays with every method
+    int header_line = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n")) != -1) {
+        switch (opt) {
+            case 'd': method = atoi(optarg); break;
+            case 'n': header_line = 0; break;
+            default:
+                fprintf(stderr, "Usage: %s [-d method (0 for all)] [-n (no header)] trace\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-d method (0 for all)] [-n (no header)] trace\n", argv[0]);
+        return -1;
+    }
+    if (load_trace(argv[optind]) == -1) {
+        return -1;
+    }
+    if (header_line) {
+        printf("method,recorded_method,processes,types,calls,trace_s,deferrals,stalled,"
+               "call_s,grants,safety_checks,unsafe_rejections,fast_path_hit_rate\n");
+    }
+    for (int m = DEADLOCK_NOTHING; m <= DEADLOCK_AVOIDANCE; m++) {
+        if (method == 0 || method == m) {
+            replay(m);
+        }
+    }
+    free(calls);
+    return 0;
+}
+
+/**
+ * Reads a trace file into calls.
+ * @param path The path of the trace
+ * @return 0 on success, -1 on error
+ */
+int load_trace(char* path) {
+    FILE* trace = fopen(path, "rb");
+    if (trace == NULL) {
+        fprintf(stderr, "Error: Cannot open the trace file %s.\n", path);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, trace) != 1 || header.magic != RALLOC_TRACE_MAGIC
+        || header.r_count < 1 || header.r_count > MAX_RESOURCE_TYPES || header.p_count < 1) {
+        fprintf(stderr, "Error: %s is not a ralloc trace.\n", path);
+        fclose(trace);
+        return -1;
+    }
+    int capacity = 0;
+    Call call;
+    call.resumed = -1;
+    call.aborted = 0;
+    while (fread(&call.record, sizeof(call.record), 1, trace) == 1) {
+        if (fread(call.vector, sizeof(int), header.r_count, trace) != (size_t) header.r_count) {
+            fprintf(stderr, "Error: The trace ends in the middle of a call.\n");
+            break;
+        }
+        if (num_calls == capacity) {
+            capacity = (capacity == 0) ? 1024 : capacity * 2;
+            Call* grown = realloc(calls, capacity * sizeof(Call));
+            if (grown == NULL) {
+                fprintf(stderr, "Error: Cannot allocate space for the calls.\n");
+                fclose(trace);
+                return -1;
+            }
+            calls = grown;
+        }
+        calls[num_calls++] = call;
+    }
+    fclose(trace);
+    link_waits();
+    return 0;
+}
+
+/**
+ * Links every RALLOC_TRACE_GRANT and RALLOC_TRACE_ABORT of a process to its
+ * request, the last call of the process before it. Those of a request made
+ * before the trace started have no request and stay unlinked.
+ */
+void link_waits() {
+    int last[header.p_count]; // last call of each process, -1 if none
+    for (int i = 0; i < header.p_count; i++) {
+        last[i] = -1;
+    }
+    for (int c = 0; c < num_calls; c++) {
+        int pid = calls[c].record.pid;
+        int op = calls[c].record.op;
+        if (pid < 0 || pid >= header.p_count || op == RALLOC_TRACE_ALTERNATIVE || op == RALLOC_TRACE_PRIORITY) {
+            continue;
+        }
+        if (op != RALLOC_TRACE_GRANT && op != RALLOC_TRACE_ABORT) {
+            last[pid] = c;
+        } else if (last[pid] != -1 && calls[last[pid]].resumed == -1
+                   && (calls[last[pid]].record.op == RALLOC_TRACE_REQUEST
+                       || calls[last[pid]].record.op == RALLOC_TRACE_REQUEST_ANY)) {
+            calls[last[pid]].resumed = c;
+            calls[last[pid]].aborted = (op == RALLOC_TRACE_ABORT);
+        }
+    }
+}
+
+/**
+ * Replays the trace with a deadlock handling method and prints its CSV line.
+ * Each process has a queue of calls that are not replayed yet. A request that
+ * would block stays at the head of its queue and is tried again after the next
+ * release; processes still blocked at the end of the trace are reported as
+ * stalled (they would be deadlocked or starved in the recorded order). A
+ * request is held back until its grant is reached in the trace, and one that
+ * was aborted is dropped at its abort and takes back everything its process
+ * holds, whatever the method of the replay.
+ * @param method The deadlock handling method
+ */
+void replay(int method) {
+    int N = header.p_count;
+    ralloc_ctx* ctx = ralloc_ctx_init(N, header.r_count, header.r_exist, method);
+    if (ctx == NULL) {
+        exit(1);
+    }
+    int* next = malloc((num_calls > 0 ? num_calls : 1) * sizeof(int)); // next call of the same process
+    int head[N], tail[N]; // queue of each process, -1 if empty
+    long tried_at[N]; // value of releases when the blocked head was last tried, -1 if not blocked
+    if (next == NULL) {
+        fprintf(stderr, "Error: Cannot allocate space for the queues.\n");
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        head[i] = tail[i] = -1;
+        tried_at[i] = -1;
+    }
+    long releases = 0;
+    long deferrals = 0;
+    long call_ns = 0;
+
+    for (int c = 0; c < num_calls; c++) {
+        int pid = calls[c].record.pid;
+        int op = calls[c].record.op;
+        if (op == RALLOC_TRACE_ALTERNATIVE) { // issued with its ralloc_request_any
+            continue;
+        }
+        if (pid < 0 || pid >= N || op == RALLOC_TRACE_PRIORITY) { // not made by a process, not queued
+            long start = wall_time_ns();
+            replay_call(ctx, method, &calls[c]);
+            call_ns += wall_time_ns() - start;
+            continue;
+        }
+        if (op == RALLOC_TRACE_ABORT) {
+            if (tail[pid] == -1 || calls[tail[pid]].resumed != c) { // no request of the trace waits for it
+                long start = wall_time_ns();
+                reclaim(ctx, pid);
+                call_ns += wall_time_ns() - start;
+                releases++;
+            }
+        } else if (op != RALLOC_TRACE_GRANT) { // a grant only lets its request through below
+            next[c] = -1;
+            if (tail[pid] == -1) {
+                head[pid] = c;
+            } else {
+                next[tail[pid]] = c;
+            }
+            tail[pid] = c;
+        }
+        // Run the processes until each one is blocked or out of calls
+        int progress = 1;
+        while (progress) {
+            progress = 0;
+            for (int i = 0; i < N; i++) {
+                while (head[i] != -1 && calls[head[i]].resumed <= c
+                       && (tried_at[i] != releases || calls[head[i]].aborted)) {
+                    Call* call = &calls[head[i]];
+                    long start = wall_time_ns();
+                    int result = call->aborted ? reclaim(ctx, i) : replay_call(ctx, method, call);
+                    call_ns += wall_time_ns() - start;
+                    if (result == RALLOC_WOULDBLOCK) {
+                        if (tried_at[i] == -1) {
+                            deferrals++;
+                        }
+                        tried_at[i] = releases;
+                        break;
+                    }
+                    tried_at[i] = -1;
+                    if (call->record.op == RALLOC_TRACE_RELEASE || call->aborted) {
+                        releases++;
+                    }
+                    head[i] = next[head[i]];
+                    if (head[i] == -1) {
+                        tail[i] = -1;
+                    }
+                    progress = 1;
+                }
+            }
+        }
+    }
+    int stalled = 0;
+    for (int i = 0; i < N; i++) {
+        stalled += (head[i] != -1);
+    }
+
+    ralloc_stats stats;
+    ralloc_ctx_stats(ctx, &stats);
+    ralloc_ctx_end(ctx);
+    free(next);
+    double trace_s = (num_calls > 0) ? calls[num_calls - 1].record.time_ns / 1e9 : 0.0;
+    printf("%d,%d,%d,%d,%d,%f,%ld,%d,%f,%ld,%ld,%ld,%.3f\n",
+           method, header.d_handling, N, header.r_count, num_calls, trace_s, deferrals, stalled,
+           call_ns / 1e9, stats.grants, stats.safety_checks, stats.unsafe_rejections,
+           stats.fast_path_hits + stats.fast_path_misses > 0
+               ? (double) stats.fast_path_hits / (stats.fast_path_hits + stats.fast_path_misses) : 0.0);
+}
+
+/**
+ * Issues a recorded call without ever blocking, requests are turned into
+ * ralloc_ctx_try_request (one per demand of a ralloc_request_any, in order) and
+ * detections, recovery methods and priorities are skipped unless the method is
+ * DEADLOCK_DETECTION.
+ * @param ctx The context of the replay
+ * @param method The deadlock handling method of the context
+ * @param call The call to be issued
+ * @return The result of the call, RALLOC_WOULDBLOCK if the request has to wait
+ */
+int replay_call(ralloc_ctx* ctx, int method, Call* call) {
+    int procarray[header.p_count];
+    switch (call->record.op) {
+        case RALLOC_TRACE_MAXDEMAND:
+            return ralloc_ctx_maxdemand(ctx, call->record.pid, call->vector);
+        case RALLOC_TRACE_REQUEST:
+            return ralloc_ctx_try_request(ctx, call->record.pid, call->vector);
+        case RALLOC_TRACE_REQUEST_ANY: {
+            int result = ralloc_ctx_try_request(ctx, call->record.pid, call->vector);
+            // The other demands follow the call in the trace
+            for (Call* alternative = call + 1; result == RALLOC_WOULDBLOCK && alternative < calls + num_calls
+                 && alternative->record.op == RALLOC_TRACE_ALTERNATIVE; alternative++) {
+                result = ralloc_ctx_try_request(ctx, call->record.pid, alternative->vector);
+            }
+            return result;
+        }
+        case RALLOC_TRACE_TRY_REQUEST: {
+            int result = ralloc_ctx_try_request(ctx, call->record.pid, call->vector);
+            return (result == RALLOC_WOULDBLOCK) ? -1 : result; // the caller did not wait either
+        }
+        case RALLOC_TRACE_RELEASE:
+            return ralloc_ctx_release(ctx, call->record.pid, call->vector);
+        case RALLOC_TRACE_DETECTION:
+            return (method == DEADLOCK_DETECTION) ? ralloc_ctx_detection(ctx, procarray) : 0;
+        case RALLOC_TRACE_RECOVERY:
+            return (method == DEADLOCK_DETECTION) ? ralloc_ctx_recovery(ctx, call->vector[0]) : 0;
+        case RALLOC_TRACE_PRIORITY:
+            return (method == DEADLOCK_DETECTION)
+                ? ralloc_ctx_priority(ctx, call->record.pid, call->vector[0]) : 0;
+        case RALLOC_TRACE_GRANT:
+        case RALLOC_TRACE_ABORT: // the end of a wait, handled by replay
+            return 0;
+        default:
+            fprintf(stderr, "Error: Unknown call %d in the trace.\n", call->record.op);
+            return -1;
+    }
+}
+
+/**
+ * Takes back everything a process holds, as the recovery of the recorded run
+ * did when it aborted the process.
+ * @param ctx The context of the replay
+ * @param pid The id of the aborted process
+ * @return The result of the release
+ */
+int reclaim(ralloc_ctx* ctx, int pid) {
+    int M = header.r_count;
+    int allocation[header.p_count * M];
+    ralloc_ctx_snapshot(ctx, NULL, allocation, NULL, NULL);
+    return ralloc_ctx_release(ctx, pid, &allocation[pid * M]);
+}
+
+/**
+ * Returns the current time of the monotonic clock.
+ * @return The current time in nanoseconds
+ */
+long wall_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}